@@ -0,0 +1,535 @@
+#include "DataCodec.h"
+
+#include <string.h>
+
+// Base64 ---------------------------------------------------------------------------
+
+static int Base64Value(char c)
+{
+	if (c >= 'A' && c <= 'Z') return c - 'A';
+	if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+	if (c >= '0' && c <= '9') return c - '0' + 52;
+	if (c == '+') return 62;
+	if (c == '/') return 63;
+	return -1;
+}
+
+bool Base64Decode(const char* text, vector<uchar>& output)
+{
+	output.clear();
+
+	if (text == NULL)
+		return false;
+
+	output.reserve(strlen(text) * 3 / 4);
+
+	uint bits = 0;
+	int count = 0;
+
+	for (const char* c = text; *c != '\0'; ++c)
+	{
+		if (*c == ' ' || *c == '\n' || *c == '\r' || *c == '\t')
+			continue;
+
+		if (*c == '=')
+			break;
+
+		int value = Base64Value(*c);
+		if (value < 0)
+			return false;
+
+		bits = (bits << 6) | value;
+		count += 6;
+
+		if (count >= 8)
+		{
+			count -= 8;
+			output.push_back((bits >> count) & 0xFF);
+		}
+	}
+
+	return true;
+}
+
+// Inflate (RFC 1950, 1951 and 1952) ------------------------------------------------
+
+#define MAX_BITS 15
+#define MAX_LENGTH_CODES 288
+#define MAX_DIST_CODES 30
+
+struct Huffman
+{
+	short count[MAX_BITS + 1]; //Codes of each length
+	short symbol[MAX_LENGTH_CODES]; //Symbols ordered by code
+};
+
+struct InflateState
+{
+	const uchar* input;
+	uint input_size;
+	uint input_pos;
+
+	uint bit_buffer;
+	int bit_count;
+
+	uchar* output;
+	uint output_size;
+	uint output_pos;
+
+	bool error;
+};
+
+static int Bits(InflateState& s, int need)
+{
+	while (s.bit_count < need)
+	{
+		if (s.input_pos >= s.input_size)
+		{
+			s.error = true;
+			return 0;
+		}
+		s.bit_buffer |= (uint)s.input[s.input_pos++] << s.bit_count;
+		s.bit_count += 8;
+	}
+
+	int value = s.bit_buffer & ((1 << need) - 1);
+	s.bit_buffer >>= need;
+	s.bit_count -= need;
+	return value;
+}
+
+//Canonical codes are built from the code lengths alone. Returns false if the lengths are over subscribed
+static bool BuildHuffman(Huffman& h, const short* lengths, int n)
+{
+	memset(h.count, 0, sizeof(h.count));
+	for (int i = 0; i < n; ++i)
+		++h.count[lengths[i]];
+
+	int left = 1;
+	for (int len = 1; len <= MAX_BITS; ++len)
+	{
+		left = (left << 1) - h.count[len];
+		if (left < 0)
+			return false;
+	}
+
+	short offsets[MAX_BITS + 1];
+	offsets[1] = 0;
+	for (int len = 1; len < MAX_BITS; ++len)
+		offsets[len + 1] = offsets[len] + h.count[len];
+
+	for (int i = 0; i < n; ++i)
+	{
+		if (lengths[i] != 0)
+			h.symbol[offsets[lengths[i]]++] = i;
+	}
+
+	return true;
+}
+
+static int Decode(InflateState& s, const Huffman& h)
+{
+	int code = 0; //Bits read so far
+	int first = 0; //First code of the current length
+	int index = 0; //Index of that first code in the symbols
+
+	for (int len = 1; len <= MAX_BITS; ++len)
+	{
+		code |= Bits(s, 1);
+		if (s.error)
+			return -1;
+
+		int count = h.count[len];
+		if (code - count < first)
+			return h.symbol[index + (code - first)];
+
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	s.error = true;
+	return -1;
+}
+
+static bool Stored(InflateState& s)
+{
+	//Stored blocks start at a byte boundary
+	s.bit_buffer = 0;
+	s.bit_count = 0;
+
+	if (s.input_pos + 4 > s.input_size)
+		return false;
+
+	uint len = s.input[s.input_pos] | (s.input[s.input_pos + 1] << 8);
+	uint nlen = s.input[s.input_pos + 2] | (s.input[s.input_pos + 3] << 8);
+	s.input_pos += 4;
+
+	if (len != (~nlen & 0xFFFF) || s.input_pos + len > s.input_size || s.output_pos + len > s.output_size)
+		return false;
+
+	memcpy(s.output + s.output_pos, s.input + s.input_pos, len);
+	s.input_pos += len;
+	s.output_pos += len;
+	return true;
+}
+
+static bool Codes(InflateState& s, const Huffman& lengths, const Huffman& distances)
+{
+	static const short length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const short length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const short dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const short dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	while (true)
+	{
+		int symbol = Decode(s, lengths);
+		if (symbol < 0)
+			return false;
+
+		if (symbol < 256)
+		{
+			if (s.output_pos >= s.output_size)
+				return false;
+			s.output[s.output_pos++] = symbol;
+		}
+		else if (symbol == 256)
+		{
+			return true;
+		}
+		else
+		{
+			symbol -= 257;
+			if (symbol >= 29)
+				return false;
+
+			uint len = length_base[symbol] + Bits(s, length_extra[symbol]);
+
+			symbol = Decode(s, distances);
+			if (symbol < 0 || symbol >= 30)
+				return false;
+
+			uint dist = dist_base[symbol] + Bits(s, dist_extra[symbol]);
+
+			if (s.error || dist > s.output_pos || s.output_pos + len > s.output_size)
+				return false;
+
+			//The copy can overlap what it writes
+			for (uint i = 0; i < len; ++i, ++s.output_pos)
+				s.output[s.output_pos] = s.output[s.output_pos - dist];
+		}
+	}
+}
+
+static bool Fixed(InflateState& s)
+{
+	//Cheap enough to build every time, no shared state between loading threads
+	Huffman lengths, distances;
+	short code_lengths[MAX_LENGTH_CODES];
+
+	int i = 0;
+	for (; i < 144; ++i) code_lengths[i] = 8;
+	for (; i < 256; ++i) code_lengths[i] = 9;
+	for (; i < 280; ++i) code_lengths[i] = 7;
+	for (; i < MAX_LENGTH_CODES; ++i) code_lengths[i] = 8;
+	BuildHuffman(lengths, code_lengths, MAX_LENGTH_CODES);
+
+	for (i = 0; i < MAX_DIST_CODES; ++i) code_lengths[i] = 5;
+	BuildHuffman(distances, code_lengths, MAX_DIST_CODES);
+
+	return Codes(s, lengths, distances);
+}
+
+static bool Dynamic(InflateState& s)
+{
+	static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	int nlen = Bits(s, 5) + 257;
+	int ndist = Bits(s, 5) + 1;
+	int ncode = Bits(s, 4) + 4;
+
+	if (s.error || nlen > MAX_LENGTH_CODES || ndist > MAX_DIST_CODES)
+		return false;
+
+	//Lengths of the code that encodes the code lengths
+	short code_lengths[MAX_LENGTH_CODES + MAX_DIST_CODES];
+	memset(code_lengths, 0, sizeof(code_lengths));
+
+	for (int i = 0; i < ncode; ++i)
+		code_lengths[order[i]] = Bits(s, 3);
+
+	Huffman lengths, distances;
+	if (s.error || BuildHuffman(lengths, code_lengths, 19) == false)
+		return false;
+
+	//Lengths of the literal/length and distance codes
+	int index = 0;
+	while (index < nlen + ndist)
+	{
+		int symbol = Decode(s, lengths);
+		if (symbol < 0)
+			return false;
+
+		if (symbol < 16)
+		{
+			code_lengths[index++] = symbol;
+			continue;
+		}
+
+		short repeat_length = 0;
+		int repeat = 0;
+
+		if (symbol == 16)
+		{
+			if (index == 0)
+				return false;
+			repeat_length = code_lengths[index - 1];
+			repeat = 3 + Bits(s, 2);
+		}
+		else if (symbol == 17)
+			repeat = 3 + Bits(s, 3);
+		else
+			repeat = 11 + Bits(s, 7);
+
+		if (s.error || index + repeat > nlen + ndist)
+			return false;
+
+		while (repeat--)
+			code_lengths[index++] = repeat_length;
+	}
+
+	//Without an end of block code the data can't end
+	if (code_lengths[256] == 0)
+		return false;
+
+	if (BuildHuffman(lengths, code_lengths, nlen) == false || BuildHuffman(distances, code_lengths + nlen, ndist) == false)
+		return false;
+
+	return Codes(s, lengths, distances);
+}
+
+//Size of the zlib or gzip header, 0 if there is none (raw DEFLATE), -1 if it's broken
+static int HeaderSize(const uchar* input, uint input_size)
+{
+	//zlib: compression method 8, no preset dictionary and a valid check
+	if (input_size >= 2 && (input[0] & 0x0F) == 8 && ((input[0] << 8) | input[1]) % 31 == 0)
+		return (input[1] & 0x20) ? -1 : 2;
+
+	//gzip
+	if (input_size >= 10 && input[0] == 0x1F && input[1] == 0x8B && input[2] == 8)
+	{
+		uchar flags = input[3];
+		uint pos = 10;
+
+		if (flags & 0x04) //Extra field
+		{
+			if (pos + 2 > input_size)
+				return -1;
+			pos += 2 + (input[pos] | (input[pos + 1] << 8));
+		}
+		if (flags & 0x08) //File name
+		{
+			while (pos < input_size && input[pos] != 0) ++pos;
+			++pos;
+		}
+		if (flags & 0x10) //Comment
+		{
+			while (pos < input_size && input[pos] != 0) ++pos;
+			++pos;
+		}
+		if (flags & 0x02) //Header crc
+			pos += 2;
+
+		return (pos <= input_size) ? (int)pos : -1;
+	}
+
+	return 0;
+}
+
+int Inflate(const uchar* input, uint input_size, uchar* output, uint output_size)
+{
+	if (input == NULL || output == NULL)
+		return -1;
+
+	int header = HeaderSize(input, input_size);
+	if (header < 0)
+		return -1;
+
+	InflateState s;
+	s.input = input;
+	s.input_size = input_size;
+	s.input_pos = header;
+	s.bit_buffer = 0;
+	s.bit_count = 0;
+	s.output = output;
+	s.output_size = output_size;
+	s.output_pos = 0;
+	s.error = false;
+
+	//The trailing checksum is not verified
+	int last = 0;
+	while (last == 0)
+	{
+		last = Bits(s, 1);
+		int type = Bits(s, 2);
+
+		if (s.error)
+			return -1;
+
+		bool ok = false;
+		switch (type)
+		{
+		case 0: ok = Stored(s); break;
+		case 1: ok = Fixed(s); break;
+		case 2: ok = Dynamic(s); break;
+		}
+
+		if (ok == false || s.error)
+			return -1;
+	}
+
+	return s.output_pos;
+}
+
+// LZ4 ------------------------------------------------------------------------------
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 //The block ends with literals
+#define LZ4_MATCH_LIMIT 12 //No match starts closer than this to the end
+#define LZ4_HASH_BITS 12
+#define LZ4_MAX_OFFSET 65535
+
+static uint Lz4Hash(const uchar* p)
+{
+	uint sequence = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static void Lz4Length(vector<uchar>& output, uint length)
+{
+	while (length >= 255)
+	{
+		output.push_back(255);
+		length -= 255;
+	}
+	output.push_back(length);
+}
+
+static void Lz4Sequence(vector<uchar>& output, const uchar* literals, uint literal_length, uint offset, uint match_length)
+{
+	uchar token = (MIN(literal_length, 15) << 4);
+	if (offset != 0)
+		token |= MIN(match_length - LZ4_MIN_MATCH, 15);
+	output.push_back(token);
+
+	if (literal_length >= 15)
+		Lz4Length(output, literal_length - 15);
+	output.insert(output.end(), literals, literals + literal_length);
+
+	//The last sequence has no match
+	if (offset != 0)
+	{
+		output.push_back(offset & 0xFF);
+		output.push_back(offset >> 8);
+		if (match_length - LZ4_MIN_MATCH >= 15)
+			Lz4Length(output, match_length - LZ4_MIN_MATCH - 15);
+	}
+}
+
+void Lz4Compress(const uchar* input, uint input_size, vector<uchar>& output)
+{
+	output.clear();
+	output.reserve(input_size + input_size / 255 + 16);
+
+	//Greedy: the last position seen of each hashed 4 bytes
+	vector<uint> table(1 << LZ4_HASH_BITS, 0xFFFFFFFF);
+
+	uint anchor = 0; //Start of the pending literals
+	uint pos = 0;
+
+	while (input_size > LZ4_MATCH_LIMIT && pos < input_size - LZ4_MATCH_LIMIT)
+	{
+		uint hash = Lz4Hash(input + pos);
+		uint candidate = table[hash];
+		table[hash] = pos;
+
+		if (candidate == 0xFFFFFFFF || pos - candidate > LZ4_MAX_OFFSET || memcmp(input + candidate, input + pos, LZ4_MIN_MATCH) != 0)
+		{
+			++pos;
+			continue;
+		}
+
+		uint length = LZ4_MIN_MATCH;
+		while (pos + length < input_size - LZ4_LAST_LITERALS && input[candidate + length] == input[pos + length])
+			++length;
+
+		Lz4Sequence(output, input + anchor, pos - anchor, pos - candidate, length);
+
+		pos += length;
+		anchor = pos;
+	}
+
+	Lz4Sequence(output, input + anchor, input_size - anchor, 0, 0);
+}
+
+int Lz4Decompress(const uchar* input, uint input_size, uchar* output, uint output_size)
+{
+	if (input == NULL || output == NULL)
+		return -1;
+
+	uint in = 0;
+	uint out = 0;
+
+	while (in < input_size)
+	{
+		uchar token = input[in++];
+
+		uint literal_length = token >> 4;
+		if (literal_length == 15)
+		{
+			uchar extra = 255;
+			while (extra == 255 && in < input_size)
+			{
+				extra = input[in++];
+				literal_length += extra;
+			}
+		}
+
+		if (in + literal_length > input_size || out + literal_length > output_size)
+			return -1;
+
+		memcpy(output + out, input + in, literal_length);
+		in += literal_length;
+		out += literal_length;
+
+		//The last sequence only has literals
+		if (in == input_size)
+			break;
+
+		if (in + 2 > input_size)
+			return -1;
+
+		uint offset = input[in] | (input[in + 1] << 8);
+		in += 2;
+
+		uint match_length = (token & 0x0F) + LZ4_MIN_MATCH;
+		if ((token & 0x0F) == 15)
+		{
+			uchar extra = 255;
+			while (extra == 255 && in < input_size)
+			{
+				extra = input[in++];
+				match_length += extra;
+			}
+		}
+
+		if (offset == 0 || offset > out || out + match_length > output_size)
+			return -1;
+
+		//The copy can overlap what it writes
+		for (uint i = 0; i < match_length; ++i, ++out)
+			output[out] = output[out - offset];
+	}
+
+	return out;
+}
@@ -0,0 +1,22 @@
+#ifndef __DATACODEC_H__
+#define __DATACODEC_H__
+
+#include "p2Defs.h"
+
+#include <vector>
+
+using namespace std;
+
+//Decodes base64 text, whitespace is skipped. Returns false on an invalid character
+bool Base64Decode(const char* text, vector<uchar>& output);
+
+//Decompresses a zlib or gzip stream (raw DEFLATE if there is no header) into output.
+//Returns the bytes written, -1 if the data is corrupt or doesn't fit
+int Inflate(const uchar* input, uint input_size, uchar* output, uint output_size);
+
+//LZ4 block format, without the frame header. Fast to decompress, used by the pack files
+void Lz4Compress(const uchar* input, uint input_size, vector<uchar>& output);
+//Returns the bytes written, -1 if the data is corrupt or doesn't fit
+int Lz4Decompress(const uchar* input, uint input_size, uchar* output, uint output_size);
+
+#endif // __DATACODEC_H__
@@ -416,17 +416,8 @@ void DevScene::LoadLevel()
 	pugi::xml_document	level_file;
 	pugi::xml_node		level;
 
-	char* buf;
-	int size = App->fs->Load("my_level.xml", &buf);
-	pugi::xml_parse_result result = level_file.load_buffer(buf, size);
-	delete[] buf;
-	buf = NULL;
-
-	if (result == NULL)
-	{
-		LOG("Could not load xml file %s. PUGI error: &s", "my_level.xml", result.description());
+	if (App->fs->LoadXML("my_level.xml", level_file) == false)
 		return;
-	}
 	else
 		level = level_file.child("level");
 
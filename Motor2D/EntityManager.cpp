@@ -149,6 +149,8 @@ bool j1EntityManager::Update(float dt)
 		if (App->game_scene->GamePaused() == false)
 			(*it)->Update(dt * bullet_time);
 
+		friendly_grid.Update(*it);
+
 		(*it)->Draw();
 		it++;
 	}
@@ -159,6 +161,8 @@ bool j1EntityManager::Update(float dt)
 		if (App->game_scene->GamePaused() == false)
 			(*i)->Update(dt * bullet_time);
 
+		enemy_grid.Update(*i);
+
 		(*i)->Draw();
 		i++;
 	}
@@ -235,6 +239,8 @@ bool j1EntityManager::CleanUp()
 	units_database.clear();
 
 	selected_units.clear();
+	friendly_grid.Clear();
+	enemy_grid.Clear();
 
 	list<Unit*>::iterator it_fu = friendly_units.begin();
 	while (it_fu != friendly_units.end())
@@ -298,6 +304,7 @@ void j1EntityManager::DestroyUnit(Unit* _unit)
 	{
 		if (*f_unit == _unit)
 		{
+			friendly_grid.Remove(_unit);
 			f_unit = friendly_units.erase(f_unit);
 			f_unit--;
 
@@ -328,6 +335,7 @@ void j1EntityManager::DestroyUnit(Unit* _unit)
 	{
 		if (*e_unit == _unit)
 		{
+			enemy_grid.Remove(_unit);
 			enemy_units.erase(e_unit);
 			delete _unit;
 			return;
@@ -341,22 +349,15 @@ bool j1EntityManager::LoadUnitsInfo()
 {
 	bool ret = true;
 
-	pugi::xml_document	unit_file;
 	pugi::xml_node		units;
 
-	char* buf;
-	int size = App->fs->Load(units_file_path.c_str(), &buf);
-	pugi::xml_parse_result result = unit_file.load_buffer(buf, size);
-	delete[] buf;
-	buf = NULL;
+	//Parsed once, every new game reads the same document
+	const pugi::xml_document* unit_file = App->fs->GetXML(units_file_path.c_str());
 
-	if (result == NULL)
-	{
-		LOG("Could not load xml file %s. PUGI error: &s", units_file_path.c_str(), result.description());
+	if (unit_file == NULL)
 		return false;
-	}
 	else
-		units = unit_file.child("units");
+		units = unit_file->child("units");
 
 	//Abilities cost
 	invisibility_cost = units.child("invisibility").attribute("cost").as_float();
@@ -880,14 +881,14 @@ void j1EntityManager::SelectUnits()
 		selection_rect.w = down_right.x - selection_rect.x;
 		selection_rect.h = down_right.y - selection_rect.y;
 
-		list<Unit*>::iterator it = friendly_units.begin();
-		while (it != friendly_units.end())
+		vector<Unit*> in_rect;
+		friendly_grid.QueryRect(selection_rect, in_rect);
+
+		vector<Unit*>::iterator it = in_rect.begin();
+		while (it != in_rect.end())
 		{
-			if ((*it)->GetPosition().PointInRect(selection_rect.x, selection_rect.y, selection_rect.w, selection_rect.h) == true)
-			{
-				selected_units.push_back((*it));
-				(*it)->selected = true;
-			}
+			selected_units.push_back((*it));
+			(*it)->selected = true;
 			it++;
 		}
 
@@ -932,15 +933,26 @@ void j1EntityManager::SetMovement()
 				//If you have some units selected & central point is not walkable--------------------------------
 				if (selected_units.size() > 1 && App->pathfinding->IsWalkable(center_map) == false)
 				{
+					//All the units go to the same destination: one flow field for the whole squad
+					const FlowField* field = App->pathfinding->GetFlowField(destination);
+
 					list<Unit*>::iterator unit_p = selected_units.begin();
 					while (unit_p != selected_units.end())
 					{
 						iPoint unit_pos = (*unit_p)->GetPosition();
 						iPoint unit_map_pos = App->map->WorldToMap(unit_pos.x, unit_pos.y, 2);
 
-						int path_result = App->pathfinding->CreatePath(unit_map_pos, destination);
-						if (path_result != -1)
-							AssignPath(*unit_p, path_result, NULL);
+						vector<iPoint> unit_path;
+						if (field != NULL && field->GetPath(unit_map_pos, unit_path))
+						{
+							AssignPath(*unit_p, unit_path, NULL);
+						}
+						else
+						{
+							int path_result = App->pathfinding->CreatePath(unit_map_pos, destination, PATH_PLAYER, *unit_p);
+							if (path_result != -1)
+								AssignPath(*unit_p, path_result, NULL);
+						}
 
 						++unit_p;
 					}
@@ -971,6 +983,9 @@ void j1EntityManager::SetMovement()
 				path.push_back(destination);
 			}
 
+			//Units that can't keep the formation share a flow field to the mouse point
+			const FlowField* field = NULL;
+
 			//Assign to each unit its path
 			list<Unit*>::iterator unit_p = selected_units.begin();
 			while (unit_p != selected_units.end())
@@ -1002,7 +1017,7 @@ void j1EntityManager::SetMovement()
 					if (App->pathfinding->IsWalkable(end_point) == true)
 					{
 						//If it is, create a path to go there
-						uint path_id = App->pathfinding->CreatePath(unit_map_pos, end_point);
+						uint path_id = App->pathfinding->CreatePath(unit_map_pos, end_point, PATH_PLAYER, *unit_p);
 						if (path_id != 1)
 							AssignPath(*unit_p, path_id, NULL);
 					}
@@ -1019,9 +1034,20 @@ void j1EntityManager::SetMovement()
 						}
 						else
 						{
-							uint path_id2 = App->pathfinding->CreatePath(unit_map_pos, destination);
-							if (path_id2 != -1)
-								AssignPath(*unit_p, path_id2, NULL);
+							if (field == NULL)
+								field = App->pathfinding->GetFlowField(destination);
+
+							vector<iPoint> unit_path;
+							if (field != NULL && field->GetPath(unit_map_pos, unit_path))
+							{
+								AssignPath(*unit_p, unit_path, NULL);
+							}
+							else
+							{
+								uint path_id2 = App->pathfinding->CreatePath(unit_map_pos, destination, PATH_PLAYER, *unit_p);
+								if (path_id2 != -1)
+									AssignPath(*unit_p, path_id2, NULL);
+							}
 						}
 					}
 				}
@@ -1116,9 +1142,16 @@ void j1EntityManager::CheckUnderCursor()
 {
 	int mouse_x, mouse_y;
 	App->input->GetMouseWorld(mouse_x, mouse_y);
-	list<Unit*>::iterator i = enemy_units.begin();
 
-	while (i != enemy_units.end())
+	//Units whose sprite can be under the mouse
+	vector<Unit*> near_units;
+	int margin = 2 * enemy_grid.GetMaxExtent();
+	SDL_Rect area = { mouse_x - margin, mouse_y - margin, 2 * margin, 2 * margin };
+	enemy_grid.QueryRect(area, near_units);
+
+	vector<Unit*>::iterator i = near_units.begin();
+
+	while (i != near_units.end())
 	{
 		if (mouse_x >= (*i)->sprite.position.x && mouse_x <= (*i)->sprite.position.x + (*i)->width && mouse_y >= (*i)->sprite.position.y && mouse_y <= (*i)->sprite.position.y + (*i)->height)
 		{
@@ -1147,8 +1180,14 @@ void j1EntityManager::CheckUnderCursor()
 	//If we have ONLY 1 medic selected
 	if (selected_units.size() == 1 && selected_units.front()->GetType() == MEDIC && selected_units.front()->state != UNIT_DIE)
 	{
-		list<Unit*>::iterator ally = friendly_units.begin();
-		while (ally != friendly_units.end())
+		margin = 2 * friendly_grid.GetMaxExtent();
+		area.x = mouse_x - margin;
+		area.y = mouse_y - margin;
+		area.w = area.h = 2 * margin;
+		friendly_grid.QueryRect(area, near_units);
+
+		vector<Unit*>::iterator ally = near_units.begin();
+		while (ally != near_units.end())
 		{
 			if (mouse_x >= (*ally)->sprite.position.x && mouse_x <= (*ally)->sprite.position.x + (*ally)->width && mouse_y >= (*ally)->sprite.position.y && mouse_y <= (*ally)->sprite.position.y + (*ally)->height)
 			{
@@ -1286,6 +1325,11 @@ void j1EntityManager::CreateUnit(UNIT_TYPE type, int x, int y, bool is_enemy, bo
 				friendly_units.push_back(unit);
 			break;
 		}
+
+		if (is_enemy)
+			enemy_grid.Insert(enemy_units.back());
+		else
+			friendly_grid.Insert(friendly_units.back());
 		return;
 	}
 	else
@@ -1362,6 +1406,9 @@ void j1EntityManager::RemoveBullet(Bullet* _bullet)
 
 void j1EntityManager::CleanUpList()
 {
+	friendly_grid.Clear();
+	enemy_grid.Clear();
+
 	list<Unit*>::iterator i = friendly_units.begin();
 
 	while (i != friendly_units.end())
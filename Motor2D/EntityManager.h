@@ -6,6 +6,7 @@
 #include "Unit.h"
 #include "Bullet.h"
 #include "Projectile.h"
+#include "UnitGrid.h"
 #include <map>
 
 #define COLLIDER_MAP 2
@@ -111,6 +112,10 @@ public:
 	list<Unit*> selected_units;
 	bool debug;
 
+	//Same units as the lists indexed by position. Updated after the units
+	UnitGrid friendly_grid;
+	UnitGrid enemy_grid;
+
 	SDL_Texture* gui_cursor;
 
 	bool SNIPPER_MODE = false;
@@ -0,0 +1,153 @@
+#include "FieldOfView.h"
+#include "j1Pathfinding.h"
+
+#include <math.h>
+
+// Transforms from the first octant to each of the 8
+static const int octants[8][4] =
+{
+	{ 1, 0, 0, 1 },
+	{ 0, 1, 1, 0 },
+	{ 0, -1, 1, 0 },
+	{ -1, 0, 0, 1 },
+	{ -1, 0, 0, -1 },
+	{ 0, -1, -1, 0 },
+	{ 0, 1, -1, 0 },
+	{ 1, 0, 0, -1 }
+};
+
+FieldOfView::FieldOfView(const WalkabilityMap& map) : map(map), radius(0), cone(false), min_cos(-1.0f), visible(NULL)
+{}
+
+void FieldOfView::ComputeCircle(const iPoint& origin, int radius, vector<bool>& visible)
+{
+	this->origin = origin;
+	this->radius = radius;
+	cone = false;
+
+	Compute(visible);
+}
+
+void FieldOfView::ComputeCone(const iPoint& origin, int radius, const fPoint& direction, float half_angle, vector<bool>& visible)
+{
+	this->origin = origin;
+	this->radius = radius;
+	this->direction = direction;
+	cone = true;
+	min_cos = cos(half_angle * M_PI / 180.0f);
+
+	//A cone without direction doesn't see anything
+	if (direction.x == 0 && direction.y == 0)
+	{
+		int side = 2 * radius + 1;
+		visible.assign(side * side, false);
+		return;
+	}
+
+	this->direction.Normalize();
+
+	Compute(visible);
+}
+
+void FieldOfView::Compute(vector<bool>& visible)
+{
+	int side = 2 * radius + 1;
+	visible.assign(side * side, false);
+	this->visible = &visible;
+
+	//A cone doesn't see its own tile, it has no direction
+	if (cone == false)
+		SetVisible(0, 0);
+
+	for (uint i = 0; i < 8; ++i)
+	{
+		//Skip the octants the cone doesn't reach. An octant covers 22.5 degrees at each side of its center
+		if (cone)
+		{
+			fPoint center(-octants[i][0] - 2.0f * octants[i][1], -octants[i][2] - 2.0f * octants[i][3]);
+			center.Normalize();
+
+			float angle = acos(MAX(-1.0f, MIN(1.0f, center.x * direction.x + center.y * direction.y))) * 180.0f / M_PI;
+			if (angle > acos(min_cos) * 180.0f / M_PI + 22.5f + 0.01f)
+				continue;
+		}
+
+		CastLight(1, 1.0f, 0.0f, octants[i][0], octants[i][1], octants[i][2], octants[i][3]);
+	}
+
+	this->visible = NULL;
+}
+
+void FieldOfView::CastLight(int row, float start, float end, int xx, int xy, int yx, int yy)
+{
+	if (start < end)
+		return;
+
+	float new_start = 0.0f;
+
+	for (int j = row; j <= radius; ++j)
+	{
+		bool blocked = false;
+
+		for (int dx = -j, dy = -j; dx <= 0; ++dx)
+		{
+			//Slopes of the left and right edges of the tile
+			float l_slope = (dx - 0.5f) / (dy + 0.5f);
+			float r_slope = (dx + 0.5f) / (dy - 0.5f);
+
+			if (start < r_slope)
+				continue;
+			if (end > l_slope)
+				break;
+
+			int x = dx * xx + dy * xy;
+			int y = dx * yx + dy * yy;
+
+			if (dx * dx + dy * dy <= radius * radius && InCone(x, y))
+				SetVisible(x, y);
+
+			bool opaque = IsOpaque(origin.x + x, origin.y + y);
+
+			if (blocked)
+			{
+				if (opaque)
+				{
+					new_start = r_slope;
+					continue;
+				}
+
+				blocked = false;
+				start = new_start;
+			}
+			else if (opaque && j < radius)
+			{
+				//The wall starts a shadow, what is at the sides is scanned in the next rows
+				blocked = true;
+				CastLight(j + 1, start, l_slope, xx, xy, yx, yy);
+				new_start = r_slope;
+			}
+		}
+
+		if (blocked)
+			break;
+	}
+}
+
+bool FieldOfView::IsOpaque(int x, int y) const
+{
+	return map.IsWalkable(iPoint(x, y)) == false;
+}
+
+bool FieldOfView::InCone(int dx, int dy) const
+{
+	if (cone == false)
+		return true;
+
+	return direction.x * dx + direction.y * dy > min_cos * sqrt((float)(dx * dx + dy * dy));
+}
+
+void FieldOfView::SetVisible(int dx, int dy)
+{
+	int side = 2 * radius + 1;
+	(*visible)[(dy + radius) * side + (dx + radius)] = true;
+}
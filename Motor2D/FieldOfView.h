@@ -0,0 +1,48 @@
+#ifndef __FIELDOFVIEW_H__
+#define __FIELDOFVIEW_H__
+
+#include "p2Defs.h"
+#include "p2Point.h"
+
+#include <vector>
+
+using namespace std;
+
+struct WalkabilityMap;
+
+// Recursive shadowcasting over the collider grid. Non walkable tiles block the vision (they are seen, not what is behind)
+class FieldOfView
+{
+public:
+
+	FieldOfView(const WalkabilityMap& map);
+
+	//Fills visible, a square of side 2 * radius + 1 centered in origin, with the tiles seen from origin
+	void ComputeCircle(const iPoint& origin, int radius, vector<bool>& visible);
+	//Same, only the tiles less than half_angle (degrees) away from direction
+	void ComputeCone(const iPoint& origin, int radius, const fPoint& direction, float half_angle, vector<bool>& visible);
+
+private:
+
+	void Compute(vector<bool>& visible);
+	void CastLight(int row, float start, float end, int xx, int xy, int yx, int yy);
+
+	bool IsOpaque(int x, int y) const;
+	bool InCone(int dx, int dy) const;
+	void SetVisible(int dx, int dy);
+
+private:
+
+	const WalkabilityMap& map;
+
+	iPoint origin;
+	int radius;
+
+	bool cone;
+	fPoint direction; //Normalized
+	float min_cos;
+
+	vector<bool>* visible;
+};
+
+#endif // __FIELDOFVIEW_H__
@@ -0,0 +1,105 @@
+#include "FlowField.h"
+#include "j1Pathfinding.h"
+
+#include <queue>
+#include <functional>
+
+FlowField::FlowField(const WalkabilityMap& map, const iPoint& destination) : width(map.width), height(map.height), destination(destination)
+{
+	cost.assign(width * height, -1);
+	flow.assign(width * height, NO_FLOW);
+
+	if (map.IsWalkable(destination) == false)
+		return;
+
+	typedef pair<int, uint> Entry; //Cost, tile index
+	priority_queue<Entry, vector<Entry>, greater<Entry> > open;
+
+	cost[destination.y * width + destination.x] = 0;
+	open.push(Entry(0, destination.y * width + destination.x));
+
+	while (open.empty() == false)
+	{
+		Entry current = open.top();
+		open.pop();
+
+		if (current.first > cost[current.second])
+			continue;
+
+		int x = current.second % width;
+		int y = current.second / width;
+
+		for (uint dir = 0; dir < 8; ++dir)
+		{
+			iPoint neighbour(x + dir_x[dir], y + dir_y[dir]);
+
+			if (map.IsWalkable(neighbour) == false)
+				continue;
+
+			int new_cost = current.first + ((dir_x[dir] != 0 && dir_y[dir] != 0) ? DIAGONAL_COST : STRAIGHT_COST);
+			uint index = neighbour.y * width + neighbour.x;
+
+			if (cost[index] == -1 || new_cost < cost[index])
+			{
+				cost[index] = new_cost;
+				flow[index] = (dir + 4) % 8; //The neighbour walks back towards the current tile
+				open.push(Entry(new_cost, index));
+			}
+		}
+	}
+}
+
+const iPoint& FlowField::GetDestination() const
+{
+	return destination;
+}
+
+bool FlowField::IsReachable(const iPoint& pos) const
+{
+	if (pos.x < 0 || pos.y < 0 || pos.x >= (int)width || pos.y >= (int)height)
+		return false;
+
+	return cost[pos.y * width + pos.x] != -1;
+}
+
+iPoint FlowField::GetNextStep(const iPoint& pos) const
+{
+	if (IsReachable(pos) == false)
+		return pos;
+
+	uchar dir = flow[pos.y * width + pos.x];
+	if (dir == NO_FLOW)
+		return pos;
+
+	return iPoint(pos.x + dir_x[dir], pos.y + dir_y[dir]);
+}
+
+bool FlowField::GetPath(const iPoint& origin, vector<iPoint>& path) const
+{
+	path.clear();
+
+	if (IsReachable(origin) == false)
+		return false;
+
+	path.push_back(origin);
+
+	iPoint current = origin;
+	uchar last_dir = NO_FLOW;
+
+	while (current != destination)
+	{
+		uchar dir = flow[current.y * width + current.x];
+
+		//Direction changed: the current tile is a waypoint
+		if (last_dir != NO_FLOW && dir != last_dir)
+			path.push_back(current);
+
+		last_dir = dir;
+		current = GetNextStep(current);
+	}
+
+	if (path.back() != destination)
+		path.push_back(destination);
+
+	return true;
+}
@@ -0,0 +1,42 @@
+#ifndef __FLOWFIELD_H__
+#define __FLOWFIELD_H__
+
+#include "p2Defs.h"
+#include "p2Point.h"
+
+#include <vector>
+
+using namespace std;
+
+#define NO_FLOW 255
+
+struct WalkabilityMap;
+
+// Dijkstra from a destination over the whole walkability map. Every tile stores the direction of its next step,
+// so all the units going to the same destination share one search
+class FlowField
+{
+public:
+
+	FlowField(const WalkabilityMap& map, const iPoint& destination);
+
+	const iPoint& GetDestination() const;
+	bool IsReachable(const iPoint& pos) const;
+
+	//Next tile to walk from pos. Returns pos if it is the destination or can't reach it
+	iPoint GetNextStep(const iPoint& pos) const;
+
+	//Follows the field from origin and keeps only the tiles where the direction changes
+	bool GetPath(const iPoint& origin, vector<iPoint>& path) const;
+
+private:
+
+	uint width;
+	uint height;
+	iPoint destination;
+
+	vector<int> cost; //Integration field, -1 if unreachable
+	vector<uchar> flow; //Direction index of the next step, NO_FLOW if none
+};
+
+#endif // __FLOWFIELD_H__
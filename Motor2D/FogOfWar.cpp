@@ -1,6 +1,7 @@
 #include "FogOfWar.h"
 #include "j1App.h"
 #include "j1Render.h"
+#include "j1Window.h"
 #include "j1Textures.h"
 #include "p2Log.h"
 
@@ -11,35 +12,36 @@ Fog_Map::Fog_Map(const int _w, const int _h)
 {
 	w = _w;
 	h = _h;
-	//Creating a new two dimensional array of tiles
-	map = new uint*[h];
-	if (w)
-	{
-		map[0] = new uint[h * w];
-		for (int i = 1; i < h; ++i)
-		{
-			map[i] = map[0] + i * w;
-		}
-	}
+	stride = (w + FOG_ROW_ALIGN - 1) & ~(FOG_ROW_ALIGN - 1);
+
+	//A single block for each set of tiles
+	map = new uchar[stride * h];
+	softened = new uchar[stride * h];
 
 	//Initializing them all non-visible
-	for (int y = 0; y < h; y++)
-	{
-		for (int x = 0; x < w; x++)
-		{
-			map[x][y] = maxAlpha;
-		}
-	}
+	SetAll(false);
 }
 
 Fog_Map::~Fog_Map()
 {
 	//Erasing the map
-	if (w)
+	RELEASE_ARRAY(map);
+	RELEASE_ARRAY(softened);
+}
+
+uchar Fog_Map::Opacity(bool visible) const
+{
+	//We define if we'll be making the tiles visibles or non-visibles
+	return (visible) ? 0 : MIN(maxAlpha, 255);
+}
+
+uchar Fog_Map::GetAlpha(int x, int y) const
+{
+	if (x >= 0 && x < w && y >= 0 && y < h)
 	{
-		delete[] map[0];
+		return softened[y * stride + x];
 	}
-	delete[] map;
+	return Opacity(false);
 }
 
 void Fog_Map::DrawCircle(int _x, int _y, int radius, bool visible)
@@ -70,12 +72,10 @@ void Fog_Map::DrawCircle(int _x, int _y, int radius, bool visible)
 		y = h - 1;
 	}
 
-	//We define if we'll be making the tiles visibles or non-visibles
-	uint opacityToSet = 0;
-	if (visible == false)
-	{
-		opacityToSet = maxAlpha;
-	}
+	uchar opacityToSet = Opacity(visible);
+
+	int firstY = y;
+	bool changed = false;
 
 	//Checking all the cells in the square with two "for"s to traverse them all
 	for (; y < _y + radius; y++)
@@ -83,15 +83,17 @@ void Fog_Map::DrawCircle(int _x, int _y, int radius, bool visible)
 		//Making sure the cell is still in the map
 		if (y < h - 1)
 		{
+			uchar* row = map + y * stride;
 			for (; x < _x + radius && x < w - 1; x++)
 			{
-				if (map[x][y] != opacityToSet)
+				if (row[x] != opacityToSet)
 				{
 					//Getting an aproximate distance from the center and comparing it to the radius to decide if it's part of the circle or not
 					int distance = (x - _x)*(x - _x) + (y - _y) * (y - _y);
 					if (distance < radius * radius)
 					{
-						map[x][y] = opacityToSet;
+						row[x] = opacityToSet;
+						changed = true;
 					}
 				}
 			}
@@ -110,25 +112,74 @@ void Fog_Map::DrawCircle(int _x, int _y, int radius, bool visible)
 		}
 	}
 
+	//Drawing the same circle again changes nothing and costs no softening
+	if (changed)
+	{
+		uniform = -1;
+		MarkDrawn(x, firstY, _x + radius - 1, _y + radius - 1);
+	}
 }
 
 void Fog_Map::SetAll(bool visible)
 {
-	//We define if we'll be making the tiles visibles or non-visibles
-	uint opacityToSet = 0;
-	if (visible == false)
+	uchar opacityToSet = Opacity(visible);
+
+	//Already done, clearing an untouched map every frame is free
+	if (uniform == (int)opacityToSet)
 	{
-		opacityToSet = maxAlpha;
+		return;
 	}
 
-	//Setting all the tiles to the correspondant value
-	for (int y = 0; y < h; y++)
+	if (base == (int)opacityToSet)
 	{
-		for (int x = 0; x < w; x++)
+		//Back to the value it had before the last circles, only their tiles are reset and softened again
+		for (vector<SDL_Rect>::iterator rect = drawn.begin(); rect != drawn.end(); ++rect)
 		{
-			map[x][y] = opacityToSet;
+			for (int y = rect->y; y < rect->y + rect->h; y++)
+			{
+				memset(map + y * stride + rect->x, opacityToSet, rect->w);
+			}
+			MarkDirty(rect->x, rect->y, rect->x + rect->w - 1, rect->y + rect->h - 1);
 		}
 	}
+	else
+	{
+		//Setting all the tiles to the correspondant value, no need to soften a map of a single value
+		memset(map, opacityToSet, stride * h);
+		memset(softened, opacityToSet, stride * h);
+		dirty.clear();
+		MarkChangedRows(0, h - 1);
+	}
+
+	uniform = base = opacityToSet;
+	drawn.clear();
+}
+
+bool Fog_Map::GetChangedRows(int& first, int& last) const
+{
+	first = changed_first;
+	last = changed_last;
+	return changed_first <= changed_last;
+}
+
+void Fog_Map::ClearChangedRows()
+{
+	changed_first = 0;
+	changed_last = -1;
+}
+
+void Fog_Map::MarkChangedRows(int first, int last)
+{
+	if (changed_first > changed_last)
+	{
+		changed_first = first;
+		changed_last = last;
+	}
+	else
+	{
+		changed_first = MIN(changed_first, first);
+		changed_last = MAX(changed_last, last);
+	}
 }
 
 void Fog_Map::CopyTo(Fog_Map* output)
@@ -137,15 +188,33 @@ void Fog_Map::CopyTo(Fog_Map* output)
 	{
 		return;
 	}
-	//Copying the map
-	for (int y = 0; y < h; y++)
+	//Copying the map, softened tiles included so the output doesn't need a refresh unless this one did
+	if (output->w == w && output->h == h)
+	{
+		memcpy(output->map, map, stride * h);
+		memcpy(output->softened, softened, stride * h);
+		output->uniform = uniform;
+		output->base = base;
+		output->dirty = dirty;
+		output->drawn = drawn;
+	}
+	else
 	{
-		for (int x = 0; x < w; x++)
+		//Different sizes, copy the common area row by row
+		uint width = MIN(w, output->w);
+		for (uint y = 0; y < h && y < output->h; y++)
 		{
-			output->map[x][y] = map[x][y];
+			memcpy(output->map + y * output->stride, map + y * stride, width);
 		}
-	}
 
+		//The sections of this map don't fit the output. It's softened again whole, and the next SetAll() resets it whole
+		output->uniform = -1;
+		output->base = -1;
+		output->dirty.clear();
+		output->drawn.clear();
+		output->MarkDirty(0, 0, output->w - 1, output->h - 1);
+	}
+	output->MarkChangedRows(0, output->h - 1);
 
 }
 
@@ -155,7 +224,7 @@ bool Fog_Map::isVisible(int x, int y)
 	if (x >= 0 && x < w && y >= 0 && y < h)
 	{
 		//This comparison defines the amount of Alpha a tile must have to decide if it's either visible or not
-		if (map[x][y] < maxAlpha / 2)
+		if (map[y * stride + x] < maxAlpha / 2)
 		{
 			return true;
 		}
@@ -235,43 +304,156 @@ void Fog_Map::SoftenSection(int x1, int y1, int x2, int y2, float fadeRatio)
 	//From top right to bottom left
 	for (int y = y1; y <= y2; y++)
 	{
+		uchar* row = softened + y * stride;
+		const uchar* up = row - stride;
+		const uchar* down = row + stride;
 		for (int x = x1; x <= x2; x++)
 		{
-			int myAlpha = map[x][y];
+			int myAlpha = row[x];
 			if ((x + 1) < w){
-				if (map[x + 1][y] > myAlpha * fadeRatio)
-					myAlpha = map[x + 1][y] / fadeRatio;
+				if (row[x + 1] > myAlpha * fadeRatio)
+					myAlpha = row[x + 1] / fadeRatio;
 			}
-			if (map[x - 1][y] > myAlpha * fadeRatio)
-				myAlpha = map[x - 1][y] / fadeRatio;
-			if (map[x][y + 1] > myAlpha * fadeRatio)
-				myAlpha = map[x][y + 1] / fadeRatio;
-			if (map[x][y - 1] > myAlpha * fadeRatio)
-				myAlpha = map[x][y - 1] / fadeRatio;
-			map[x][y] = myAlpha;
+			if (row[x - 1] > myAlpha * fadeRatio)
+				myAlpha = row[x - 1] / fadeRatio;
+			if (down[x] > myAlpha * fadeRatio)
+				myAlpha = down[x] / fadeRatio;
+			if (up[x] > myAlpha * fadeRatio)
+				myAlpha = up[x] / fadeRatio;
+			row[x] = myAlpha;
 		}
 	}
 
 	//From bottom left to top right
 	for (int y = y2; y >= y1; y--)
 	{
+		uchar* row = softened + y * stride;
+		const uchar* up = row - stride;
+		const uchar* down = row + stride;
 		for (int x = x2; x >= x1; x--)
 		{
-			int myAlpha = map[x][y];
+			int myAlpha = row[x];
 			if ((x + 1) < w){
-				if (map[x + 1][y] > myAlpha * fadeRatio)
-					myAlpha = map[x + 1][y] / fadeRatio;
+				if (row[x + 1] > myAlpha * fadeRatio)
+					myAlpha = row[x + 1] / fadeRatio;
 			}
-			if (map[x - 1][y] > myAlpha * fadeRatio)
-				myAlpha = map[x - 1][y] / fadeRatio;
-			if (map[x][y + 1] > myAlpha * fadeRatio)
-				myAlpha = map[x][y + 1] / fadeRatio;
-			if (map[x][y - 1] > myAlpha * fadeRatio)
-				myAlpha = map[x][y - 1] / fadeRatio;
-			map[x][y] = myAlpha;
+			if (row[x - 1] > myAlpha * fadeRatio)
+				myAlpha = row[x - 1] / fadeRatio;
+			if (down[x] > myAlpha * fadeRatio)
+				myAlpha = down[x] / fadeRatio;
+			if (up[x] > myAlpha * fadeRatio)
+				myAlpha = up[x] / fadeRatio;
+			row[x] = myAlpha;
+		}
+	}
+
+}
+
+//Sections touching one already in the list are merged with it
+static void AddSection(vector<SDL_Rect>& sections, const SDL_Rect& section)
+{
+	for (vector<SDL_Rect>::iterator rect = sections.begin(); rect != sections.end(); ++rect)
+	{
+		if (section.x <= rect->x + rect->w && rect->x <= section.x + section.w &&
+			section.y <= rect->y + rect->h && rect->y <= section.y + section.h)
+		{
+			int left = MIN(rect->x, section.x);
+			int top = MIN(rect->y, section.y);
+			rect->w = MAX(rect->x + rect->w, section.x + section.w) - left;
+			rect->h = MAX(rect->y + rect->h, section.y + section.h) - top;
+			rect->x = left;
+			rect->y = top;
+			return;
+		}
+	}
+
+	sections.push_back(section);
+
+	//Too many sections, keep a single one around all of them
+	if (sections.size() > MAX_DIRTY_RECTS)
+	{
+		SDL_Rect all = sections[0];
+		for (uint i = 1; i < sections.size(); ++i)
+		{
+			int right = MAX(all.x + all.w, sections[i].x + sections[i].w);
+			int bottom = MAX(all.y + all.h, sections[i].y + sections[i].h);
+			all.x = MIN(all.x, sections[i].x);
+			all.y = MIN(all.y, sections[i].y);
+			all.w = right - all.x;
+			all.h = bottom - all.y;
+		}
+		sections.clear();
+		sections.push_back(all);
+	}
+}
+
+bool Fog_Map::GetSection(int x1, int y1, int x2, int y2, SDL_Rect& section) const
+{
+	//Making sure the section is in the map
+	x1 = MAX(x1, 0);
+	y1 = MAX(y1, 0);
+	x2 = MIN(x2, (int)w - 1);
+	y2 = MIN(y2, (int)h - 1);
+
+	if (x2 < x1 || y2 < y1)
+	{
+		return false;
+	}
+
+	section = { x1, y1, x2 - x1 + 1, y2 - y1 + 1 };
+	return true;
+}
+
+void Fog_Map::MarkDirty(int x1, int y1, int x2, int y2)
+{
+	SDL_Rect section;
+	if (GetSection(x1, y1, x2, y2, section))
+	{
+		AddSection(dirty, section);
+	}
+}
+
+void Fog_Map::MarkDrawn(int x1, int y1, int x2, int y2)
+{
+	SDL_Rect section;
+	if (GetSection(x1, y1, x2, y2, section))
+	{
+		AddSection(dirty, section);
+		AddSection(drawn, section);
+	}
+}
+
+bool Fog_Map::Refresh(float fadeRatio)
+{
+	if (dirty.empty())
+	{
+		return false;
+	}
+
+	//The fade of a changed tile spreads until its alpha is gone, the tiles that far away may change too
+	float ratio = MAX(fadeRatio, 1.3f);
+	int reach = ceil(log((float)maxAlpha + 1.0f) / log(ratio));
+
+	for (vector<SDL_Rect>::iterator rect = dirty.begin(); rect != dirty.end(); ++rect)
+	{
+		int x1 = MAX(rect->x - reach, 0);
+		int y1 = MAX(rect->y - reach, 0);
+		int x2 = MIN(rect->x + rect->w - 1 + reach, (int)w - 1);
+		int y2 = MIN(rect->y + rect->h - 1 + reach, (int)h - 1);
+
+		//Start again from the drawn tiles
+		for (int y = y1; y <= y2; y++)
+		{
+			memcpy(softened + y * stride + x1, map + y * stride + x1, x2 - x1 + 1);
 		}
+
+		//Softening reads the neighbours, the map border is left as it is
+		SoftenSection(MAX(x1, 1), MAX(y1, 1), MIN(x2, (int)w - 2), MIN(y2, (int)h - 2), fadeRatio);
+		MarkChangedRows(y1, y2);
 	}
 
+	dirty.clear();
+	return true;
 }
 
 
@@ -323,6 +505,13 @@ void FogOfWar::EraseMaps()
 		RELEASE(maps[n]);
 	}
 	maps.clear();
+
+	for (int n = 0; n < textures.size(); n++)
+	{
+		if (textures[n] != NULL)
+			SDL_DestroyTexture(textures[n]);
+	}
+	textures.clear();
 	ready = false;
 }
 
@@ -332,46 +521,105 @@ void FogOfWar::Draw()
 	if (ready == false)
 		return;
 
-	//Rect to draw, we'll only draw the tiles displayed on screen (culling)
-	int startX = App->render->camera.x / (tileW * 2);
-	int startY = App->render->camera.y / (tileH * 2);
-
-	if (startX < 0){
-		startX = -startX;
-	}
-
-	if (startY < 0){
-		startY = -startY;
+	if (textures.size() != maps.size())
+	{
+		textures.resize(maps.size(), NULL);
 	}
 
-	uint endX = startX + App->render->camera.w / (tileW * 2) + 1;
-	uint endY = startY + App->render->camera.h / (tileH * 2) + 1;
+	uint scale = App->win->GetScale();
 
-	//Drawing all fog maps
-	for (vector<Fog_Map*>::reverse_iterator currentMap = maps.rbegin(); currentMap != maps.rend(); currentMap++)
+	//Drawing all fog maps, a single scaled blit each
+	for (int n = maps.size() - 1; n >= 0; n--)
 	{
+		Fog_Map* currentMap = maps[n];
 
-		int map_height = (*currentMap)->GetHeight();
-		int map_width = (*currentMap)->GetWidth();
-
-		if ((*currentMap)->draw)
+		if (currentMap->draw)
 		{
-			//Soften the fog edges of the section we'll render
-			(*currentMap)->SoftenSection(startX, startY, endX, endY);
-			for (int y = startY; y <= endY && y < map_height; y++)
+			//Soften the fog edges only where it changed. Untouched maps cost nothing
+			currentMap->Refresh();
+
+			if (textures[n] == NULL)
 			{
-				for (int x = startX; x <= endX && x < map_width; x++)
-				{
-					//Now the fog is just black rectangles with diferents alphas. Diferent methods will be explained.
+				textures[n] = CreateTexture(currentMap);
+				if (textures[n] == NULL)
+					continue;
+			}
+			UpdateTexture(currentMap, textures[n]);
 
-					App->render->DrawQuad({ x * tileW, y * tileH, tileW, tileH }, 0, 0, 0, (*currentMap)->map[y][x], true, true);
+			//Nothing to draw on a map without fog
+			if (currentMap->IsClear())
+				continue;
 
-				}
+			//The fog starts at the world origin, scaled like j1Render::DrawQuad() does
+			SDL_Rect rect;
+			rect.x = (int)(App->render->camera.x);
+			rect.y = (int)(App->render->camera.y);
+			rect.w = (int)(currentMap->GetWidth() * tileW * scale);
+			rect.h = (int)(currentMap->GetHeight() * tileH * scale);
+
+			if (SDL_RenderCopy(App->render->renderer, textures[n], NULL, &rect) != 0)
+			{
+				LOG("Cannot blit the fog. SDL_RenderCopy error: %s", SDL_GetError());
 			}
 		}
 	}
 }
 
+SDL_Texture* FogOfWar::CreateTexture(Fog_Map* fog_map)
+{
+	//The scale quality is read when the texture is created
+	string quality = (SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY) != NULL) ? SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY) : "0";
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
+	SDL_Texture* texture = SDL_CreateTexture(App->render->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, fog_map->GetWidth(), fog_map->GetHeight());
+
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, quality.c_str());
+
+	if (texture == NULL)
+	{
+		LOG("Could not create the fog texture. SDL_CreateTexture error: %s", SDL_GetError());
+		return NULL;
+	}
+
+	SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+	//Upload the whole map
+	fog_map->MarkChangedRows(0, fog_map->GetHeight() - 1);
+	return texture;
+}
+
+void FogOfWar::UpdateTexture(Fog_Map* fog_map, SDL_Texture* texture)
+{
+	int first, last;
+	if (fog_map->GetChangedRows(first, last) == false)
+		return;
+
+	int width = fog_map->GetWidth();
+	SDL_Rect rows = { 0, first, width, last - first + 1 };
+	void* pixels = NULL;
+	int pitch = 0;
+
+	if (SDL_LockTexture(texture, &rows, &pixels, &pitch) != 0)
+	{
+		LOG("Could not update the fog texture. SDL_LockTexture error: %s", SDL_GetError());
+		return;
+	}
+
+	//Black texels, the tile alpha in the alpha channel
+	for (int y = first; y <= last; y++)
+	{
+		Uint32* row = (Uint32*)((Uint8*)pixels + (y - first) * pitch);
+		const uchar* tiles = fog_map->GetRow(y);
+		for (int x = 0; x < width; x++)
+		{
+			row[x] = (Uint32)tiles[x] << 24;
+		}
+	}
+
+	SDL_UnlockTexture(texture);
+	fog_map->ClearChangedRows();
+}
+
 void FogOfWar::DrawCircle(int x, int y, uint radius, bool visible, int map)
 {
 	//Cheking if the module has been SetUp
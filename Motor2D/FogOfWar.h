@@ -2,8 +2,14 @@
 #define __FOG_WAR__
 
 #include "j1Module.h"
+#include "SDL\include\SDL_rect.h"
 #include <vector>
 
+#define MAX_DIRTY_RECTS 16 //Past this the dirty regions are merged in a single one
+#define FOG_ROW_ALIGN 16 //Bytes, rows start aligned so the bulk loops can be vectorised
+
+struct SDL_Texture;
+
 class Fog_Map
 {
 public:
@@ -24,23 +30,67 @@ public:
 	bool isVisible(int x, int y);
 
 	//Number of width tiles
-	uint GetWidth() { return w; }
+	uint GetWidth() const { return w; }
 	//Number of height tiles
-	uint GetHeight() { return h; }
+	uint GetHeight() const { return h; }
+
+	//Read access for other systems. Tiles are stored by rows, GetStride() bytes apart, one alpha byte per tile
+	uint GetStride() const { return stride; }
+	//Softened alpha, the one to render
+	const uchar* GetTiles() const { return softened; }
+	const uchar* GetRow(int y) const { return softened + y * stride; }
+	//Alpha as it was drawn
+	const uchar* GetDrawnTiles() const { return map; }
+	//Softened alpha of a tile, maxAlpha outside the map
+	uchar GetAlpha(int x, int y) const;
 
 	//Soften the edges of a certain section of the map
 	void SoftenSection(int x1, int y1, int x2, int y2, float fadeRatio = 1.5f);
 
+	//Mark a section of tiles (both corners included) to be softened again
+	void MarkDirty(int x1, int y1, int x2, int y2);
+	bool IsDirty() const { return dirty.empty() == false; }
+	//Soften again only the sections changed since the last refresh. Returns false if there was nothing to do
+	bool Refresh(float fadeRatio = 1.5f);
+	//True if all the tiles are visible, nothing to draw
+	bool IsClear() const { return uniform == 0; }
+
+	//Rows of softened tiles changed since the last ClearChangedRows(). Returns false if there are none
+	bool GetChangedRows(int& first, int& last) const;
+	void MarkChangedRows(int first, int last);
+	void ClearChangedRows();
+
 	//Alpha the non-visible tiles will have
 	uint maxAlpha = 255;
 
-	uint** map;
-
 	//Defines if this map will be drawn
 	bool draw = true;
+private:
+	uchar Opacity(bool visible) const;
+	//Section of the map between both corners, false if it's outside
+	bool GetSection(int x1, int y1, int x2, int y2, SDL_Rect& section) const;
+	//Mark a section changed by a drawing, SetAll() only has to reset those
+	void MarkDrawn(int x1, int y1, int x2, int y2);
+
 private:
 	uint w = 0;
 	uint h = 0;
+	uint stride = 0;
+
+	//Tiles as they were drawn
+	uchar* map = NULL;
+	//Tiles with the edges softened
+	uchar* softened = NULL;
+
+	vector<SDL_Rect> dirty;
+	//Alpha of every tile while the whole map has the same one, -1 otherwise
+	int uniform = -1;
+	//Alpha of the tiles outside the drawn sections, the one of the last SetAll()
+	int base = -1;
+	vector<SDL_Rect> drawn;
+
+	int changed_first = 0;
+	int changed_last = -1;
 };
 
 class FogOfWar : public j1Module
@@ -76,9 +126,17 @@ private:
 	//Create a new FogMap
 	int CreateMap(int w, int h, int maxAlpha = 255);
 
+	//Streaming texture of a map, one texel per tile. Linear filtering smooths the edges when scaled
+	SDL_Texture* CreateTexture(Fog_Map* fog_map);
+	//Upload the rows changed since the last frame
+	void UpdateTexture(Fog_Map* fog_map, SDL_Texture* texture);
+
 public:
 	//List of Fog maps
 	vector<Fog_Map*> maps;
+private:
+	//Texture of each map, created the first time it's drawn
+	vector<SDL_Texture*> textures;
 private:
 	//Declares if the module has been SetUp and it's usable or not.
 	bool ready = false;
@@ -464,17 +464,9 @@ void GameScene::LoadGame(const char* path)
 	pugi::xml_document	level_file;
 	pugi::xml_node		level;
 
-	char* buf;
-	int size = App->fs->Load(path, &buf);
-	pugi::xml_parse_result result = level_file.load_buffer(buf, size);
-	delete[] buf;
-	buf = NULL;
-
-	if (result == NULL)
-	{
-		LOG("Could not load xml file %s. PUGI error: &s", "my_level.xml", result.description());
+	//Saves change between loads, so they aren't cached
+	if (App->fs->LoadXML(path, level_file) == false)
 		return;
-	}
 	else
 		level = level_file.child("level");
 
@@ -829,19 +821,19 @@ void GameScene::SelectFX(UNIT_TYPE type)
 	switch (type)
 	{
 	case MARINE:
-		App->audio->PlayFx(marine_select);
+		App->audio->PlayFx(marine_select, 0, FX_HIGH);
 		break;
 	case GHOST:
-		App->audio->PlayFx(ghost_select);
+		App->audio->PlayFx(ghost_select, 0, FX_HIGH);
 		break;
 	case FIREBAT:
-		App->audio->PlayFx(firebat_select);
+		App->audio->PlayFx(firebat_select, 0, FX_HIGH);
 		break;
 	case MEDIC:
-		App->audio->PlayFx(medic_select);
+		App->audio->PlayFx(medic_select, 0, FX_HIGH);
 		break;
 	case OBSERVER:
-		App->audio->PlayFx(observer_select);
+		App->audio->PlayFx(observer_select, 0, FX_HIGH);
 		break;
 	}
 }
@@ -851,19 +843,19 @@ void GameScene::MoveFX(UNIT_TYPE type)
 	switch (type)
 	{
 	case MARINE:
-		App->audio->PlayFx(marine_order);
+		App->audio->PlayFx(marine_order, 0, FX_HIGH);
 		break;
 	case GHOST:
-		App->audio->PlayFx(ghost_order);
+		App->audio->PlayFx(ghost_order, 0, FX_HIGH);
 		break;
 	case FIREBAT:
-		App->audio->PlayFx(firebat_order);
+		App->audio->PlayFx(firebat_order, 0, FX_HIGH);
 		break;
 	case MEDIC:
-		App->audio->PlayFx(medic_order);
+		App->audio->PlayFx(medic_order, 0, FX_HIGH);
 		break;
 	case OBSERVER:
-		App->audio->PlayFx(observer_order);
+		App->audio->PlayFx(observer_order, 0, FX_HIGH);
 		break;
 	}
 }
@@ -873,16 +865,16 @@ void GameScene::AttackFX(UNIT_TYPE type)
 	switch (type)
 	{
 	case MARINE:
-		App->audio->PlayFx(marine_attack_order);
+		App->audio->PlayFx(marine_attack_order, 0, FX_HIGH);
 		break;
 	case GHOST:
-		App->audio->PlayFx(ghost_attack_order);
+		App->audio->PlayFx(ghost_attack_order, 0, FX_HIGH);
 		break;
 	case FIREBAT:
-		App->audio->PlayFx(firebat_attack_order);
+		App->audio->PlayFx(firebat_attack_order, 0, FX_HIGH);
 		break;
 	case MEDIC:
-		App->audio->PlayFx(medic_attack_order);
+		App->audio->PlayFx(medic_attack_order, 0, FX_HIGH);
 		break;
 	}
 }
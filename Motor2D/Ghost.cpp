@@ -298,7 +298,7 @@ void Ghost::Shoot(int x, int y)
 	App->render->SetTransition(cam_initial.x, cam_initial.y);
 
 	//Play sound
-	App->audio->PlayFx(App->entity->sound_shoot);
+	App->audio->PlayFx(App->entity->sound_shoot, 0, FX_LOW);
 }
 
 void Ghost::DisableSnipper()
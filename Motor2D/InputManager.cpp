@@ -180,21 +180,14 @@ bool InputManager::LoadShortcutsInfo()
 
 	//TODO: Load shortcuts info
 
-	pugi::xml_document	inputs_data;
 	pugi::xml_node		node;
 
-	char* buf;
-	int size = App->fs->Load(inputs_file_path.c_str(), &buf);
-	pugi::xml_parse_result result = inputs_data.load_buffer(buf, size);
-	delete[] buf;
+	const pugi::xml_document* inputs_data = App->fs->GetXML(inputs_file_path.c_str());
 
-	if (result == NULL)
-	{
-		LOG("Could not load xml file %s. PUGI error: &s", inputs_file_path.c_str(), result.description());
+	if (inputs_data == NULL)
 		return false;
-	}
 	else
-		node = inputs_data.child("inputs_data");
+		node = inputs_data->child("inputs_data");
 
 	for (node = node.child("shortcut"); node && ret; node = node.next_sibling("shortcut"))
 	{
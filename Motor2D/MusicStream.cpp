@@ -0,0 +1,221 @@
+#include "MusicStream.h"
+#include "j1App.h"
+#include "j1FileSystem.h"
+
+#include <string.h>
+
+#define WAV_FORMAT_PCM 1
+
+MusicStream::MusicStream() : file(NULL), data_start(0), data_size(0), data_pos(0), frame_bytes(0), out_channels(0), convert(false), block_samples(0), failed(false)
+{
+	written.store(0);
+	read.store(0);
+}
+
+MusicStream::~MusicStream()
+{
+	Close();
+}
+
+bool MusicStream::Open(const char* path, int freq, Uint16 format, int channels)
+{
+	Close();
+
+	this->path = path;
+	out_channels = channels;
+
+	file = App->fs->OpenRead(path);
+	if (file == NULL)
+	{
+		error = "file not found";
+		return false;
+	}
+
+	uint src_channels = 0;
+	uint src_rate = 0;
+	uint src_bits = 0;
+
+	//RIFF header, then the chunks. Only "fmt " and "data" are needed
+	uchar header[12];
+	if (SDL_RWread(file, header, 1, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+	{
+		error = "not a wav file";
+		Close();
+		return false;
+	}
+
+	while (data_start == 0)
+	{
+		uchar chunk[8];
+		if (SDL_RWread(file, chunk, 1, 8) != 8)
+			break;
+
+		uint size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | (chunk[7] << 24);
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+		{
+			uchar fmt[16];
+			if (SDL_RWread(file, fmt, 1, 16) != 16)
+				break;
+
+			if ((fmt[0] | (fmt[1] << 8)) != WAV_FORMAT_PCM)
+			{
+				error = "only PCM wavs can be streamed";
+				Close();
+				return false;
+			}
+
+			src_channels = fmt[2] | (fmt[3] << 8);
+			src_rate = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | (fmt[7] << 24);
+			src_bits = fmt[14] | (fmt[15] << 8);
+
+			//Rest of the chunk, chunks are padded to 2 bytes
+			SDL_RWseek(file, (size - 16) + (size & 1), RW_SEEK_CUR);
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			data_start = (uint)SDL_RWtell(file);
+			data_size = size;
+		}
+		else
+			SDL_RWseek(file, size + (size & 1), RW_SEEK_CUR);
+	}
+
+	if (data_start == 0 || src_channels == 0 || (src_bits != 8 && src_bits != 16))
+	{
+		error = "unsupported wav format";
+		Close();
+		return false;
+	}
+
+	frame_bytes = src_channels * (src_bits / 8);
+	data_size -= data_size % frame_bytes;
+
+	int built = SDL_BuildAudioCVT(&cvt, (src_bits == 8) ? AUDIO_U8 : AUDIO_S16LSB, src_channels, src_rate, format, channels, freq);
+	if (built < 0)
+	{
+		error = SDL_GetError();
+		Close();
+		return false;
+	}
+
+	convert = (built == 1);
+
+	uint block_bytes = MUSIC_BLOCK_FRAMES * frame_bytes;
+	block.resize(block_bytes * (convert ? cvt.len_mult : 1));
+	block_samples = (uint)(block_bytes * (convert ? cvt.len_ratio : 1.0)) / sizeof(Sint16) + 64; //The rate conversion can round up
+
+	buffer.resize(MUSIC_BUFFER_SAMPLES);
+
+	return true;
+}
+
+void MusicStream::Close()
+{
+	if (file != NULL)
+	{
+		SDL_RWclose(file);
+		file = NULL;
+	}
+
+	data_start = data_size = data_pos = 0;
+	written.store(0);
+	read.store(0);
+}
+
+bool MusicStream::Fill()
+{
+	if (file == NULL || failed)
+		return false;
+
+	uint mask = buffer.size() - 1;
+
+	while (buffer.size() - (written.load(memory_order_relaxed) - read.load(memory_order_acquire)) >= block_samples)
+	{
+		//Back to the start, the music loops
+		if (data_pos >= data_size)
+		{
+			if (SDL_RWseek(file, data_start, RW_SEEK_SET) < 0)
+			{
+				failed = true;
+				return false;
+			}
+			data_pos = 0;
+		}
+
+		uint bytes = MIN(MUSIC_BLOCK_FRAMES * frame_bytes, data_size - data_pos);
+		uint got = SDL_RWread(file, &block[0], 1, bytes);
+		got -= got % frame_bytes;
+
+		if (got == 0)
+		{
+			failed = true;
+			return false;
+		}
+
+		data_pos += got;
+
+		uint out_bytes = got;
+		if (convert)
+		{
+			cvt.buf = &block[0];
+			cvt.len = got;
+			SDL_ConvertAudio(&cvt);
+			out_bytes = cvt.len_cvt;
+		}
+
+		//Into the ring buffer, it may wrap around
+		uint samples = out_bytes / sizeof(Sint16);
+		uint start = written.load(memory_order_relaxed);
+		const Sint16* src = (const Sint16*)&block[0];
+
+		for (uint i = 0; i < samples; ++i)
+			buffer[(start + i) & mask] = src[i];
+
+		written.store(start + samples, memory_order_release);
+	}
+
+	return true;
+}
+
+uint MusicStream::Mix(Sint16* stream, uint samples, float gain, float gain_step)
+{
+	uint start = read.load(memory_order_relaxed);
+	uint available = written.load(memory_order_acquire) - start;
+	uint count = MIN(samples, available);
+	count -= count % out_channels;
+
+	uint mask = buffer.size() - 1;
+
+	for (uint i = 0; i < count; i += out_channels)
+	{
+		float volume = MAX(MIN(gain, 1.0f), 0.0f);
+
+		for (uint c = 0; c < out_channels; ++c)
+		{
+			int value = stream[i + c] + (int)(buffer[(start + i + c) & mask] * volume);
+			stream[i + c] = (Sint16)MAX(MIN(value, 32767), -32768);
+		}
+
+		gain += gain_step;
+	}
+
+	read.store(start + count, memory_order_release);
+
+	return count;
+}
+
+bool MusicStream::IsPrefetched() const
+{
+	return failed || buffer.size() - (written.load() - read.load()) < block_samples;
+}
+
+const string& MusicStream::GetPath() const
+{
+	return path;
+}
+
+const string& MusicStream::GetError() const
+{
+	return error;
+}
@@ -0,0 +1,65 @@
+#ifndef __MUSICSTREAM_H__
+#define __MUSICSTREAM_H__
+
+#include "p2Defs.h"
+#include "SDL/include/SDL.h"
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+#define MUSIC_BUFFER_SAMPLES (1 << 17) //Decoded ahead, about 3 seconds at 22050Hz stereo. Must be a power of 2
+#define MUSIC_BLOCK_FRAMES 4096 //Frames read from the file at once
+
+// A looping PCM wav read from the file a block at a time and converted to the mixer format.
+// One thread fills the buffer and the audio thread mixes it, they only share the two positions
+class MusicStream
+{
+public:
+
+	MusicStream();
+	~MusicStream();
+
+	//Only reads the header. freq, format and channels are the ones of the mixer
+	bool Open(const char* path, int freq, Uint16 format, int channels);
+	void Close();
+
+	//Decodes until the buffer is full. False if the file can't be read anymore
+	bool Fill();
+	//Adds the next samples to stream, the volume goes from gain by gain_step each frame. Returns the samples mixed
+	uint Mix(Sint16* stream, uint samples, float gain, float gain_step);
+
+	bool IsPrefetched() const; //Enough to start playing without a gap
+	const string& GetPath() const;
+	const string& GetError() const;
+
+private:
+
+	bool ReadHeader();
+
+private:
+
+	string			path;
+	string			error;
+	SDL_RWops*		file;
+
+	uint			data_start; //Of the samples in the file
+	uint			data_size;
+	uint			data_pos;
+	uint			frame_bytes; //In the file
+	uint			out_channels;
+
+	SDL_AudioCVT	cvt;
+	bool			convert;
+	vector<uchar>	block; //A block of the file, converted in place
+	uint			block_samples; //Size of a converted block, room that Fill() needs in the buffer
+
+	vector<Sint16>	buffer;
+	atomic<uint>	written; //Samples, they wrap around
+	atomic<uint>	read;
+	bool			failed;
+};
+
+#endif // __MUSICSTREAM_H__
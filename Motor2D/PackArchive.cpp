@@ -0,0 +1,312 @@
+#include "PackArchive.h"
+#include "DataCodec.h"
+#include "p2Log.h"
+
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define PACK_MIN_SAVING 8 //Compressed only if it's at least 1/8 smaller
+
+PackArchive::PackArchive() : view(NULL), view_size(0), header(NULL), entries(NULL), names(NULL)
+#ifdef _WIN32
+	, file_handle(NULL), mapping(NULL)
+#endif
+{}
+
+PackArchive::~PackArchive()
+{
+	Close();
+}
+
+bool PackArchive::Open(const char* file)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	file_handle = handle;
+	view_size = GetFileSize(handle, NULL);
+	mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL)
+		view = (const uchar*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		view_size = (uint)info.st_size;
+		void* address = mmap(NULL, view_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		view = (address != MAP_FAILED) ? (const uchar*)address : NULL;
+	}
+	close(fd);
+#endif
+
+	if (view == NULL)
+	{
+		LOG("Cannot map pack %s", file);
+		Close();
+		return false;
+	}
+
+	//Everything is checked once here, Get() trusts the index
+	header = (const PackHeader*)view;
+	if (view_size < sizeof(PackHeader) || memcmp(header->magic, PACK_MAGIC, 4) != 0 || header->version != PACK_VERSION)
+	{
+		LOG("%s is not a pack or has a different version", file);
+		Close();
+		return false;
+	}
+
+	//64 bits so a corrupt count can't wrap around the size check
+	uint64 index_end = sizeof(PackHeader) + (uint64)header->count * sizeof(PackEntry);
+	if (index_end + header->names_size > view_size)
+	{
+		LOG("Pack %s is truncated", file);
+		Close();
+		return false;
+	}
+
+	entries = (const PackEntry*)(view + sizeof(PackHeader));
+	names = (const char*)(view + index_end);
+
+	//Names are read as C strings, the last one must end inside the table
+	if (header->names_size == 0 || names[header->names_size - 1] != '\0')
+	{
+		LOG("Pack %s has a corrupt name table", file);
+		Close();
+		return false;
+	}
+
+	for (uint i = 0; i < header->count; ++i)
+	{
+		const PackEntry& entry = entries[i];
+		if ((uint64)entry.offset + entry.size > view_size || entry.name >= header->names_size)
+		{
+			LOG("Pack %s has a broken entry", file);
+			Close();
+			return false;
+		}
+	}
+
+	unpacked.assign(header->count, NULL);
+
+	LOG("Mapped pack %s with %d files", file, header->count);
+	return true;
+}
+
+void PackArchive::Close()
+{
+	for (vector<char*>::iterator i = unpacked.begin(); i != unpacked.end(); ++i)
+		RELEASE_ARRAY(*i);
+	unpacked.clear();
+
+#ifdef _WIN32
+	if (view != NULL)
+		UnmapViewOfFile(view);
+	if (mapping != NULL)
+		CloseHandle(mapping);
+	if (file_handle != NULL)
+		CloseHandle(file_handle);
+	mapping = file_handle = NULL;
+#else
+	if (view != NULL)
+		munmap((void*)view, view_size);
+#endif
+
+	view = NULL;
+	view_size = 0;
+	header = NULL;
+	entries = NULL;
+	names = NULL;
+}
+
+bool PackArchive::Exists(const char* name) const
+{
+	return Find(name) != NULL;
+}
+
+bool PackArchive::Get(const char* name, FileSpan& span)
+{
+	const PackEntry* entry = Find(name);
+	if (entry == NULL)
+		return false;
+
+	span.size = entry->unpacked_size;
+	span.owned = NULL;
+
+	if ((entry->flags & PACK_COMPRESSED) == 0)
+	{
+		span.data = (const char*)view + entry->offset;
+		return true;
+	}
+
+	//Decompressed the first time it's asked for
+	lock_guard<mutex> lock(unpack_mutex);
+	char*& data = unpacked[entry - entries];
+
+	if (data == NULL)
+	{
+		data = new char[MAX(entry->unpacked_size, 1)];
+		int size = Lz4Decompress(view + entry->offset, entry->size, (uchar*)data, entry->unpacked_size);
+
+		if (size != (int)entry->unpacked_size)
+		{
+			RELEASE_ARRAY(data);
+			return false;
+		}
+	}
+
+	span.data = data;
+	return true;
+}
+
+uint PackArchive::Count() const
+{
+	return (header != NULL) ? header->count : 0;
+}
+
+uint64 PackArchive::Hash(const char* name)
+{
+	//FNV-1a, either slash is the same
+	uint64 hash = 14695981039346656037ULL;
+	for (const char* c = name; *c != '\0'; ++c)
+	{
+		hash ^= (uchar)((*c == '\\') ? '/' : *c);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+const PackEntry* PackArchive::Find(const char* name) const
+{
+	if (entries == NULL)
+		return NULL;
+
+	uint64 hash = Hash(name);
+
+	//First entry with the hash, then check the names in case two paths share it
+	uint first = 0;
+	uint count = header->count;
+	while (count > 0)
+	{
+		uint half = count / 2;
+		if (entries[first + half].hash < hash)
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+			count = half;
+	}
+
+	for (uint i = first; i < header->count && entries[i].hash == hash; ++i)
+	{
+		const char* entry_name = names + entries[i].name;
+		const char* c = name;
+
+		while (*c != '\0' && (*c == *entry_name || (*c == '\\' && *entry_name == '/')))
+		{
+			++c;
+			++entry_name;
+		}
+
+		if (*c == '\0' && *entry_name == '\0')
+			return &entries[i];
+	}
+
+	return NULL;
+}
+
+void PackArchive::Build(vector<PackFile>& files, vector<uchar>& output, bool compress)
+{
+	PackHeader pack_header;
+	memcpy(pack_header.magic, PACK_MAGIC, 4);
+	pack_header.version = PACK_VERSION;
+	pack_header.count = files.size();
+
+	string all_names;
+	vector<uint> name_offsets(files.size());
+
+	//Index order: by hash, then by the file order
+	vector<pair<uint64, uint>> order(files.size());
+
+	for (uint i = 0; i < files.size(); ++i)
+	{
+		replace(files[i].name.begin(), files[i].name.end(), '\\', '/');
+
+		name_offsets[i] = all_names.size();
+		all_names.append(files[i].name.data(), files[i].name.size() + 1);
+		order[i] = pair<uint64, uint>(Hash(files[i].name.data()), i);
+	}
+
+	pack_header.names_size = all_names.size();
+	sort(order.begin(), order.end());
+
+	//The data goes after the index and the names, stored files aligned to a page
+	uint offset = sizeof(PackHeader) + files.size() * sizeof(PackEntry) + all_names.size();
+	vector<PackEntry> index(files.size());
+	vector<vector<uchar>> packed(files.size());
+
+	for (uint i = 0; i < order.size(); ++i)
+	{
+		const vector<uchar>& data = files[order[i].second].data;
+		PackEntry& entry = index[i];
+
+		entry.hash = order[i].first;
+		entry.name = name_offsets[order[i].second];
+		entry.unpacked_size = data.size();
+		entry.flags = 0;
+		entry.padding = 0;
+
+		if (compress && data.empty() == false)
+		{
+			Lz4Compress(&data[0], data.size(), packed[i]);
+
+			if (packed[i].size() <= data.size() - data.size() / PACK_MIN_SAVING)
+				entry.flags |= PACK_COMPRESSED;
+			else
+				packed[i].clear();
+		}
+
+		if ((entry.flags & PACK_COMPRESSED) == 0)
+			offset = (offset + PACK_PAGE_SIZE - 1) & ~(PACK_PAGE_SIZE - 1);
+
+		entry.offset = offset;
+		entry.size = (entry.flags & PACK_COMPRESSED) ? packed[i].size() : data.size();
+		offset += entry.size;
+	}
+
+	output.clear();
+	output.reserve(offset);
+
+	const uchar* bytes = (const uchar*)&pack_header;
+	output.insert(output.end(), bytes, bytes + sizeof(PackHeader));
+
+	bytes = index.empty() ? NULL : (const uchar*)&index[0];
+	output.insert(output.end(), bytes, bytes + index.size() * sizeof(PackEntry));
+	output.insert(output.end(), all_names.begin(), all_names.end());
+
+	for (uint i = 0; i < index.size(); ++i)
+	{
+		//Zeros up to the page of a stored file
+		output.resize(index[i].offset, 0);
+
+		const vector<uchar>& data = (index[i].flags & PACK_COMPRESSED) ? packed[i] : files[order[i].second].data;
+		output.insert(output.end(), data.begin(), data.end());
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef __PACKARCHIVE_H__
+#define __PACKARCHIVE_H__
+
+#include "p2Defs.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+using namespace std;
+
+#define PACK_MAGIC "SPAK"
+#define PACK_VERSION 1
+#define PACK_PAGE_SIZE 4096 //Stored entries start at a page, so they can be used straight from the mapping
+#define PACK_COMPRESSED 1 //Entry flag, LZ4 block
+
+//Read only view of a file. Valid until it's released with j1FileSystem::Release()
+struct FileSpan
+{
+	const char*	data = NULL;
+	uint		size = 0;
+	char*		owned = NULL; //Set when the data had to be copied
+};
+
+//Layout in the file, after the header. Sorted by hash
+struct PackEntry
+{
+	uint64	hash;
+	uint	offset;
+	uint	size; //In the pack
+	uint	unpacked_size;
+	uint	name; //Offset in the names, after the index
+	uint	flags;
+	uint	padding;
+};
+
+struct PackHeader
+{
+	char	magic[4];
+	uint	version;
+	uint	count;
+	uint	names_size;
+};
+
+//Input of PackArchive::Build()
+struct PackFile
+{
+	string			name; //Inside the pack
+	vector<uchar>	data;
+};
+
+// Read only archive mapped in memory. The index is a sorted array of path hashes searched in place,
+// stored files are returned without copies and compressed ones are decompressed once and kept
+class PackArchive
+{
+public:
+
+	PackArchive();
+	~PackArchive();
+
+	bool Open(const char* file);
+	void Close();
+
+	bool Exists(const char* name) const;
+	//The span belongs to the archive, it stays valid until Close(). False for a corrupt entry, without LOG(): it's called from the loading threads
+	bool Get(const char* name, FileSpan& span);
+
+	uint Count() const;
+
+	//Lays out a pack with these files in output. Compresses the ones that shrink enough
+	static void Build(vector<PackFile>& files, vector<uchar>& output, bool compress = true);
+	static uint64 Hash(const char* name);
+
+private:
+
+	const PackEntry* Find(const char* name) const;
+
+private:
+
+	const uchar*		view; //The whole file
+	uint				view_size;
+	const PackHeader*	header;
+	const PackEntry*	entries;
+	const char*			names;
+
+	vector<char*>		unpacked; //Decompressed entries, by index
+	mutex				unpack_mutex; //Get() can be called from the loading threads
+
+#ifdef _WIN32
+	void*				file_handle;
+	void*				mapping;
+#endif
+};
+
+#endif // __PACKARCHIVE_H__
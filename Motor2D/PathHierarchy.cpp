@@ -0,0 +1,375 @@
+#include "PathHierarchy.h"
+#include "j1Pathfinding.h"
+#include "j1PerfTimer.h"
+
+#include <queue>
+#include <functional>
+
+PathHierarchy::PathHierarchy(const shared_ptr<const WalkabilityMap>& map) : map(map)
+{
+	clusters_x = (map->width + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	clusters_y = (map->height + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+
+	clusters.resize(clusters_x * clusters_y);
+	for (uint cy = 0; cy < clusters_y; ++cy)
+	{
+		for (uint cx = 0; cx < clusters_x; ++cx)
+		{
+			Cluster& cluster = clusters[cy * clusters_x + cx];
+			cluster.x = cx * CLUSTER_SIZE;
+			cluster.y = cy * CLUSTER_SIZE;
+			cluster.w = MIN(CLUSTER_SIZE, (int)map->width - cluster.x);
+			cluster.h = MIN(CLUSTER_SIZE, (int)map->height - cluster.y);
+		}
+	}
+
+	node_at.resize(map->width * map->height, -1);
+
+	CreateEntrances();
+	ConnectClusters();
+}
+
+uint PathHierarchy::GetNumNodes() const
+{
+	return nodes.size();
+}
+
+uint PathHierarchy::GetNumClusters() const
+{
+	return clusters.size();
+}
+
+uint PathHierarchy::GetClusterAt(const iPoint& pos) const
+{
+	return (pos.y / CLUSTER_SIZE) * clusters_x + (pos.x / CLUSTER_SIZE);
+}
+
+uint PathHierarchy::AddNode(const iPoint& pos, uint cluster)
+{
+	int& index = node_at[pos.y * map->width + pos.x];
+
+	if (index == -1)
+	{
+		index = nodes.size();
+
+		AbstractNode node;
+		node.pos = pos;
+		node.cluster = cluster;
+		nodes.push_back(node);
+
+		clusters[cluster].nodes.push_back(index);
+	}
+
+	return index;
+}
+
+void PathHierarchy::CreateEntrance(const iPoint& a, const iPoint& b, uint cluster_a, uint cluster_b)
+{
+	uint node_a = AddNode(a, cluster_a);
+	uint node_b = AddNode(b, cluster_b);
+
+	nodes[node_a].edges.push_back(AbstractEdge(node_b, STRAIGHT_COST));
+	nodes[node_b].edges.push_back(AbstractEdge(node_a, STRAIGHT_COST));
+}
+
+void PathHierarchy::CreateEntrances()
+{
+	for (uint cy = 0; cy < clusters_y; ++cy)
+	{
+		for (uint cx = 0; cx < clusters_x; ++cx)
+		{
+			uint index = cy * clusters_x + cx;
+			const Cluster& cluster = clusters[index];
+
+			//Border with the right cluster
+			if (cx + 1 < clusters_x)
+			{
+				int x = cluster.x + cluster.w - 1;
+				int start = -1;
+
+				for (int y = cluster.y; y <= cluster.y + cluster.h; ++y)
+				{
+					bool open = y < cluster.y + cluster.h && map->IsWalkable(iPoint(x, y)) && map->IsWalkable(iPoint(x + 1, y));
+
+					if (open && start == -1)
+						start = y;
+					else if (open == false && start != -1)
+					{
+						int end = y - 1;
+						if (end - start + 1 < MAX_SINGLE_ENTRANCE)
+						{
+							int middle = (start + end) / 2;
+							CreateEntrance(iPoint(x, middle), iPoint(x + 1, middle), index, index + 1);
+						}
+						else
+						{
+							CreateEntrance(iPoint(x, start), iPoint(x + 1, start), index, index + 1);
+							CreateEntrance(iPoint(x, end), iPoint(x + 1, end), index, index + 1);
+						}
+						start = -1;
+					}
+				}
+			}
+
+			//Border with the cluster below
+			if (cy + 1 < clusters_y)
+			{
+				int y = cluster.y + cluster.h - 1;
+				int start = -1;
+
+				for (int x = cluster.x; x <= cluster.x + cluster.w; ++x)
+				{
+					bool open = x < cluster.x + cluster.w && map->IsWalkable(iPoint(x, y)) && map->IsWalkable(iPoint(x, y + 1));
+
+					if (open && start == -1)
+						start = x;
+					else if (open == false && start != -1)
+					{
+						int end = x - 1;
+						if (end - start + 1 < MAX_SINGLE_ENTRANCE)
+						{
+							int middle = (start + end) / 2;
+							CreateEntrance(iPoint(middle, y), iPoint(middle, y + 1), index, index + clusters_x);
+						}
+						else
+						{
+							CreateEntrance(iPoint(start, y), iPoint(start, y + 1), index, index + clusters_x);
+							CreateEntrance(iPoint(end, y), iPoint(end, y + 1), index, index + clusters_x);
+						}
+						start = -1;
+					}
+				}
+			}
+		}
+	}
+}
+
+void PathHierarchy::ConnectClusters()
+{
+	vector<int> dist;
+
+	vector<Cluster>::const_iterator cluster = clusters.begin();
+	while (cluster != clusters.end())
+	{
+		for (uint i = 0; i < cluster->nodes.size(); ++i)
+		{
+			AbstractNode& from = nodes[cluster->nodes[i]];
+			ClusterDistances(from.pos, *cluster, dist);
+
+			for (uint j = 0; j < cluster->nodes.size(); ++j)
+			{
+				if (i == j)
+					continue;
+
+				const iPoint& to = nodes[cluster->nodes[j]].pos;
+				int cost = dist[(to.y - cluster->y) * cluster->w + (to.x - cluster->x)];
+
+				if (cost >= 0)
+					from.edges.push_back(AbstractEdge(cluster->nodes[j], cost));
+			}
+		}
+		++cluster;
+	}
+}
+
+void PathHierarchy::ClusterDistances(const iPoint& from, const Cluster& cluster, vector<int>& dist) const
+{
+	typedef pair<int, int> Entry; //Cost, local tile index
+	priority_queue<Entry, vector<Entry>, greater<Entry> > open;
+
+	dist.assign(cluster.w * cluster.h, -1);
+
+	int start = (from.y - cluster.y) * cluster.w + (from.x - cluster.x);
+	dist[start] = 0;
+	open.push(Entry(0, start));
+
+	while (open.empty() == false)
+	{
+		Entry current = open.top();
+		open.pop();
+
+		if (current.first > dist[current.second])
+			continue;
+
+		int lx = current.second % cluster.w;
+		int ly = current.second / cluster.w;
+
+		for (int dy = -1; dy <= 1; ++dy)
+		{
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				int nx = lx + dx;
+				int ny = ly + dy;
+
+				if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= cluster.w || ny >= cluster.h)
+					continue;
+
+				if (map->IsWalkable(iPoint(cluster.x + nx, cluster.y + ny)) == false)
+					continue;
+
+				int cost = current.first + ((dx != 0 && dy != 0) ? DIAGONAL_COST : STRAIGHT_COST);
+				int index = ny * cluster.w + nx;
+
+				if (dist[index] == -1 || cost < dist[index])
+				{
+					dist[index] = cost;
+					open.push(Entry(cost, index));
+				}
+			}
+		}
+	}
+}
+
+// Octile distance, admissible with the costs used to build the graph
+static int Heuristic(const iPoint& a, const iPoint& b)
+{
+	int dx = abs(a.x - b.x);
+	int dy = abs(a.y - b.y);
+
+	return STRAIGHT_COST * (dx + dy) + (DIAGONAL_COST - 2 * STRAIGHT_COST) * MIN(dx, dy);
+}
+
+bool PathHierarchy::FindAbstractPath(const iPoint& origin, const iPoint& destination, vector<iPoint>& waypoints) const
+{
+	waypoints.clear();
+
+	AbstractSearch search;
+	if (StartAbstractPath(origin, destination, search) == false)
+		return false;
+
+	ContinueAbstractPath(search, waypoints);
+	return waypoints.empty() == false;
+}
+
+bool PathHierarchy::StartAbstractPath(const iPoint& origin, const iPoint& destination, AbstractSearch& search) const
+{
+	if (map->IsWalkable(origin) == false || map->IsWalkable(destination) == false)
+		return false;
+
+	uint origin_cluster = GetClusterAt(origin);
+	search.dst_cluster = GetClusterAt(destination);
+	const Cluster& o_cluster = clusters[origin_cluster];
+	const Cluster& d_cluster = clusters[search.dst_cluster];
+
+	search.origin = origin;
+	search.destination = destination;
+
+	//Origin and destination are inserted as two temporary nodes after the graph ones
+	search.goal = nodes.size();
+	search.start = nodes.size() + 1;
+
+	vector<int> origin_dist;
+	ClusterDistances(origin, o_cluster, origin_dist);
+	ClusterDistances(destination, d_cluster, search.dst_dist);
+
+	search.g.assign(nodes.size() + 2, -1);
+	search.parent.assign(nodes.size() + 2, search.start);
+	search.closed.assign(nodes.size() + 2, false);
+
+	search.g[search.start] = 0;
+	search.closed[search.start] = true;
+
+	for (uint i = 0; i < o_cluster.nodes.size(); ++i)
+	{
+		uint n = o_cluster.nodes[i];
+		int cost = origin_dist[(nodes[n].pos.y - o_cluster.y) * o_cluster.w + (nodes[n].pos.x - o_cluster.x)];
+
+		if (cost >= 0)
+		{
+			search.g[n] = cost;
+			search.open.push(AbstractSearch::Entry(cost + Heuristic(nodes[n].pos, destination), n));
+		}
+	}
+
+	if (origin_cluster == search.dst_cluster)
+	{
+		int cost = origin_dist[(destination.y - o_cluster.y) * o_cluster.w + (destination.x - o_cluster.x)];
+
+		if (cost >= 0)
+		{
+			search.g[search.goal] = cost;
+			search.open.push(AbstractSearch::Entry(cost, search.goal));
+		}
+	}
+
+	return true;
+}
+
+bool PathHierarchy::ContinueAbstractPath(AbstractSearch& search, vector<iPoint>& waypoints, double max_time) const
+{
+	j1PerfTimer timer;
+
+	const Cluster& d_cluster = clusters[search.dst_cluster];
+	uint goal = search.goal;
+	vector<int>& g = search.g;
+	vector<uint>& parent = search.parent;
+	vector<bool>& closed = search.closed;
+
+	while (search.open.empty() == false && closed[goal] == false)
+	{
+		uint current = search.open.top().second;
+		search.open.pop();
+
+		if (closed[current])
+			continue;
+
+		closed[current] = true;
+
+		if (current == goal)
+			break;
+
+		const AbstractNode& node = nodes[current];
+
+		vector<AbstractEdge>::const_iterator edge = node.edges.begin();
+		while (edge != node.edges.end())
+		{
+			int cost = g[current] + edge->cost;
+
+			if (closed[edge->to] == false && (g[edge->to] == -1 || cost < g[edge->to]))
+			{
+				g[edge->to] = cost;
+				parent[edge->to] = current;
+				search.open.push(AbstractSearch::Entry(cost + Heuristic(nodes[edge->to].pos, search.destination), edge->to));
+			}
+			++edge;
+		}
+
+		//Nodes of the destination cluster connect to the temporary goal node
+		if (node.cluster == search.dst_cluster)
+		{
+			int to_goal = search.dst_dist[(node.pos.y - d_cluster.y) * d_cluster.w + (node.pos.x - d_cluster.x)];
+
+			if (to_goal >= 0 && (g[goal] == -1 || g[current] + to_goal < g[goal]))
+			{
+				g[goal] = g[current] + to_goal;
+				parent[goal] = current;
+				search.open.push(AbstractSearch::Entry(g[goal], goal));
+			}
+		}
+
+		if (max_time >= 0 && timer.ReadMs() * 1000.0 >= max_time)
+			return false;
+	}
+
+	waypoints.clear();
+
+	if (closed[goal] == false)
+		return true;
+
+	//Backtrack
+	waypoints.push_back(search.destination);
+
+	uint current = parent[goal];
+	while (current != search.start)
+	{
+		if (nodes[current].pos != waypoints.back())
+			waypoints.push_back(nodes[current].pos);
+		current = parent[current];
+	}
+
+	if (search.origin != waypoints.back())
+		waypoints.push_back(search.origin);
+	reverse(waypoints.begin(), waypoints.end());
+
+	return true;
+}
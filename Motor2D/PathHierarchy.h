@@ -0,0 +1,104 @@
+#ifndef __PATHHIERARCHY_H__
+#define __PATHHIERARCHY_H__
+
+#include "p2Defs.h"
+#include "p2Point.h"
+
+#include <vector>
+#include <memory>
+#include <queue>
+#include <functional>
+
+using namespace std;
+
+#define CLUSTER_SIZE 16 //Tiles per cluster side
+#define MAX_SINGLE_ENTRANCE 6 //Longer border openings get an entrance at each end
+#define STRAIGHT_COST 10
+#define DIAGONAL_COST 14
+
+struct WalkabilityMap;
+
+struct AbstractEdge
+{
+	AbstractEdge(uint to, int cost) : to(to), cost(cost)
+	{}
+
+	uint to;
+	int cost;
+};
+
+struct AbstractNode
+{
+	iPoint pos;
+	uint cluster;
+	vector<AbstractEdge> edges;
+};
+
+struct Cluster
+{
+	//Area in tiles
+	int x, y;
+	int w, h;
+	vector<uint> nodes;
+};
+
+//Abstract search in progress, it can be split in several calls
+struct AbstractSearch
+{
+	typedef pair<int, uint> Entry; //Score, node
+
+	iPoint origin;
+	iPoint destination;
+	uint goal = 0; //Temporary nodes of the origin and the destination, after the graph ones
+	uint start = 0;
+	uint dst_cluster = 0;
+	vector<int> dst_dist;
+
+	vector<int> g;
+	vector<uint> parent;
+	vector<bool> closed;
+	priority_queue<Entry, vector<Entry>, greater<Entry> > open;
+};
+
+// HPA* abstraction of the walkability map. The map is split in clusters, the walkable openings between two clusters
+// are the entrances and each cluster stores the cost between its entrances. Immutable once built so the solver threads can share it
+class PathHierarchy
+{
+public:
+
+	PathHierarchy(const shared_ptr<const WalkabilityMap>& map);
+
+	//Abstract search from origin to destination. Fills the waypoints (origin and destination included)
+	bool FindAbstractPath(const iPoint& origin, const iPoint& destination, vector<iPoint>& waypoints) const;
+	//Same in steps: false if origin or destination aren't walkable
+	bool StartAbstractPath(const iPoint& origin, const iPoint& destination, AbstractSearch& search) const;
+	//False if max_time (us) ran out first, -1 is no limit. Once finished the waypoints are filled, empty if there is no path
+	bool ContinueAbstractPath(AbstractSearch& search, vector<iPoint>& waypoints, double max_time = -1) const;
+
+	uint GetNumNodes() const;
+	uint GetNumClusters() const;
+
+private:
+
+	void CreateEntrances();
+	void CreateEntrance(const iPoint& a, const iPoint& b, uint cluster_a, uint cluster_b);
+	void ConnectClusters();
+
+	uint AddNode(const iPoint& pos, uint cluster);
+	uint GetClusterAt(const iPoint& pos) const;
+
+	//Dijkstra restricted to the cluster. dist is filled with the cost to every tile of the cluster (-1 if unreachable)
+	void ClusterDistances(const iPoint& from, const Cluster& cluster, vector<int>& dist) const;
+
+private:
+
+	shared_ptr<const WalkabilityMap> map;
+
+	uint clusters_x;
+	uint clusters_y;
+	vector<Cluster> clusters;
+	vector<AbstractNode> nodes;
+	vector<int> node_at; //Node index of each tile, -1 if none
+};
+
+#endif // __PATHHIERARCHY_H__
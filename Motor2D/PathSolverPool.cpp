@@ -0,0 +1,172 @@
+#include "PathSolverPool.h"
+#include "j1Pathfinding.h"
+
+#include <chrono>
+
+// PathQueue ------------------------------------------------------------------------
+PathQueue::PathQueue()
+{
+	for (size_t i = 0; i < PATH_QUEUE_SIZE; ++i)
+	{
+		cells[i].sequence.store(i, memory_order_relaxed);
+		cells[i].path = NULL;
+	}
+
+	enqueue_pos.store(0, memory_order_relaxed);
+	dequeue_pos.store(0, memory_order_relaxed);
+}
+
+bool PathQueue::Push(Path* path)
+{
+	size_t pos = enqueue_pos.load(memory_order_relaxed);
+
+	while (true)
+	{
+		Cell* cell = &cells[pos & (PATH_QUEUE_SIZE - 1)];
+		size_t seq = cell->sequence.load(memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			//The cell is free, try to claim it
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+			{
+				cell->path = path;
+				cell->sequence.store(pos + 1, memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = enqueue_pos.load(memory_order_relaxed);
+		}
+	}
+}
+
+bool PathQueue::Pop(Path*& path)
+{
+	size_t pos = dequeue_pos.load(memory_order_relaxed);
+
+	while (true)
+	{
+		Cell* cell = &cells[pos & (PATH_QUEUE_SIZE - 1)];
+		size_t seq = cell->sequence.load(memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0)
+		{
+			//The cell has a path, try to take it
+			if (dequeue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+			{
+				path = cell->path;
+				cell->sequence.store(pos + PATH_QUEUE_SIZE, memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+		{
+			return false;
+		}
+		else
+		{
+			pos = dequeue_pos.load(memory_order_relaxed);
+		}
+	}
+}
+
+// PathSolverPool -------------------------------------------------------------------
+PathSolverPool::PathSolverPool()
+{
+	running.store(false);
+	pending.store(0);
+}
+
+PathSolverPool::~PathSolverPool()
+{
+	Stop();
+}
+
+void PathSolverPool::Start(uint num_threads)
+{
+	Stop();
+
+	running.store(true);
+
+	for (uint i = 0; i < num_threads; ++i)
+		workers.push_back(thread(&PathSolverPool::WorkerLoop, this));
+}
+
+void PathSolverPool::Stop()
+{
+	if (workers.empty())
+		return;
+
+	{
+		lock_guard<mutex> lock(wake_mutex);
+		running.store(false);
+	}
+	wake.notify_all();
+
+	for (vector<thread>::iterator worker = workers.begin(); worker != workers.end(); ++worker)
+		worker->join();
+
+	workers.clear();
+
+	//Paths left in the queue are owned by j1PathFinding, just forget them
+	Path* path = NULL;
+	for (uint i = 0; i < PATH_PRIORITIES; ++i)
+	{
+		while (queues[i].Pop(path))
+			--pending;
+	}
+}
+
+bool PathSolverPool::Push(Path* path)
+{
+	if (workers.empty() || queues[path->priority].Push(path) == false)
+		return false;
+
+	++pending;
+	wake.notify_one();
+
+	return true;
+}
+
+void PathSolverPool::WorkerLoop()
+{
+	PathGrid* grid = NULL;
+
+	while (running.load())
+	{
+		Path* path = NULL;
+
+		bool found = false;
+		for (uint i = 0; i < PATH_PRIORITIES && found == false; ++i)
+			found = queues[i].Pop(path);
+
+		if (found == false)
+		{
+			unique_lock<mutex> lock(wake_mutex);
+			wake.wait_for(lock, chrono::milliseconds(5), [this]() { return running.load() == false || pending.load() > 0; });
+			continue;
+		}
+
+		--pending;
+
+		//Each thread has its own grid, rebuilt if the map size changed
+		const WalkabilityMap* map = path->walk_map.get();
+		if (grid == NULL || grid->width != map->width || grid->height != map->height)
+		{
+			RELEASE(grid);
+			grid = new PathGrid(map->width, map->height);
+		}
+
+		j1PathFinding::SolvePath(path, grid, -1);
+	}
+
+	RELEASE(grid);
+}
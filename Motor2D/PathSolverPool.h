@@ -0,0 +1,80 @@
+#ifndef __PATHSOLVERPOOL_H__
+#define __PATHSOLVERPOOL_H__
+
+#include "p2Defs.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+#define PATH_QUEUE_SIZE 1024 //Must be a power of 2
+
+struct Path;
+
+//Lower value is solved first
+enum PATH_PRIORITY
+{
+	PATH_PLAYER, //Orders of the player
+	PATH_CHASE, //AI units going after a target
+	PATH_PATROL, //AI units patrolling or going back to their post
+	PATH_PRIORITIES
+};
+
+// Bounded lock free queue of paths. Safe with multiple producers and consumers
+class PathQueue
+{
+public:
+
+	PathQueue();
+
+	bool Push(Path* path); //False if the queue is full
+	bool Pop(Path*& path); //False if the queue is empty
+
+private:
+
+	struct Cell
+	{
+		atomic<size_t> sequence;
+		Path* path;
+	};
+
+	Cell cells[PATH_QUEUE_SIZE];
+	atomic<size_t> enqueue_pos;
+	atomic<size_t> dequeue_pos;
+};
+
+// Background threads that take paths from the queues, highest priority first, and solve them to completion
+class PathSolverPool
+{
+public:
+
+	PathSolverPool();
+	~PathSolverPool();
+
+	void Start(uint num_threads);
+	void Stop();
+
+	bool Push(Path* path); //False if the path must be solved in the main thread
+
+private:
+
+	void WorkerLoop();
+
+private:
+
+	PathQueue queues[PATH_PRIORITIES];
+	vector<thread> workers;
+
+	atomic<bool> running;
+	atomic<int> pending;
+
+	//Only used to sleep the threads while there is no work
+	mutex wake_mutex;
+	condition_variable wake;
+};
+
+#endif // __PATHSOLVERPOOL_H__
@@ -0,0 +1,162 @@
+#include "RenderQueue.h"
+#include "p2Log.h"
+
+RenderQueue::RenderQueue() : sequence(0), batches(0)
+{}
+
+void RenderQueue::Push(RENDER_LAYER layer, const Sprite* sprite)
+{
+	if (sprite == NULL)
+		return;
+
+	RenderCommand command;
+	command.key = 0;
+	command.layer = layer;
+	command.source = sprite;
+	commands.push_back(command);
+}
+
+void RenderQueue::PushCopy(RENDER_LAYER layer, const Sprite& sprite)
+{
+	RenderCommand command;
+	command.key = 0;
+	command.layer = layer;
+	command.source = NULL;
+	command.sprite = sprite;
+	commands.push_back(command);
+}
+
+uint64 RenderQueue::MakeKey(RENDER_LAYER layer, int order, uint texture)
+{
+	//Layer | order (24 bits) | texture (16 bits)
+	uint64 biased = (uint64)MAX(MIN(order + SORT_Y_BIAS, (1 << 24) - 1), 0);
+	return ((uint64)layer << 40) | (biased << 16) | (texture & 0xFFFF);
+}
+
+uint RenderQueue::GetTextureIndex(SDL_Texture* texture)
+{
+	map<SDL_Texture*, uint>::iterator it = textures.find(texture);
+	if (it != textures.end())
+		return it->second;
+
+	uint index = textures.size();
+	textures.insert(pair<SDL_Texture*, uint>(texture, index));
+	return index;
+}
+
+void RenderQueue::Sort()
+{
+	//Build the keys with the sprites as they are now
+	sequence = 0;
+	for (vector<RenderCommand>::iterator command = commands.begin(); command != commands.end(); ++command)
+	{
+		if (command->source != NULL)
+		{
+			//World sprites are never scaled
+			command->sprite = *command->source;
+			command->sprite.size = 1.0f;
+		}
+
+		int order = (command->source != NULL) ? command->sprite.position.y : sequence++;
+		command->key = MakeKey(command->layer, order, GetTextureIndex(command->sprite.texture));
+	}
+
+	//LSD radix sort, stable so equal keys keep the push order
+	buffer.resize(commands.size());
+	uint count[1 << RADIX_BITS];
+
+	for (uint shift = 0; shift < 48; shift += RADIX_BITS)
+	{
+		memset(count, 0, sizeof(count));
+		for (uint i = 0; i < commands.size(); ++i)
+			++count[(commands[i].key >> shift) & ((1 << RADIX_BITS) - 1)];
+
+		//All the keys share this digit, nothing to move
+		if (commands.empty() || count[(commands[0].key >> shift) & ((1 << RADIX_BITS) - 1)] == commands.size())
+			continue;
+
+		uint offset = 0;
+		for (uint d = 0; d < (1 << RADIX_BITS); ++d)
+		{
+			uint c = count[d];
+			count[d] = offset;
+			offset += c;
+		}
+
+		for (uint i = 0; i < commands.size(); ++i)
+			buffer[count[(commands[i].key >> shift) & ((1 << RADIX_BITS) - 1)]++] = commands[i];
+
+		commands.swap(buffer);
+	}
+}
+
+uint RenderQueue::Submit(SDL_Renderer* renderer, const SDL_Rect& camera)
+{
+	uint ret = 0;
+	batches = 0;
+
+	SDL_Rect screen = { 0, 0, camera.w, camera.h };
+	SDL_Texture* current = NULL;
+	int current_alpha = 255;
+
+	for (vector<RenderCommand>::const_iterator command = commands.begin(); command != commands.end(); ++command)
+	{
+		const Sprite& sprite = command->sprite;
+
+		//Same placement than j1Render::Blit
+		const SDL_Rect& section = sprite.rect;
+		SDL_Rect rect;
+		rect.x = camera.x + sprite.position.x + (int)((section.w - (section.w * sprite.size)) * 0.5f);
+		rect.y = camera.y + sprite.position.y + (int)((section.h - (section.h * sprite.size)) * 0.5f);
+		rect.w = section.w * sprite.size;
+		rect.h = section.h * sprite.size;
+
+		if (sprite.texture == NULL || SDL_HasIntersection(&rect, &screen) == SDL_FALSE)
+			continue;
+
+		//The texture state only changes between batches or when the alpha does
+		if (sprite.texture != current)
+		{
+			if (current != NULL && current_alpha != 255)
+				SDL_SetTextureAlphaMod(current, 255);
+
+			current = sprite.texture;
+			current_alpha = 255;
+			++batches;
+		}
+
+		int alpha = MIN(sprite.alpha, 255);
+		if (alpha != current_alpha)
+		{
+			SDL_SetTextureAlphaMod(current, alpha);
+			current_alpha = alpha;
+		}
+
+		if (SDL_RenderCopy(renderer, current, &section, &rect) != 0)
+			LOG("Cannot blit to screen. SDL_RenderCopy error: %s", SDL_GetError());
+
+		++ret;
+	}
+
+	if (current != NULL && current_alpha != 255)
+		SDL_SetTextureAlphaMod(current, 255);
+
+	return ret;
+}
+
+void RenderQueue::Clear()
+{
+	//The memory is kept for the next frame
+	commands.clear();
+	textures.clear();
+}
+
+uint RenderQueue::Size() const
+{
+	return commands.size();
+}
+
+uint RenderQueue::GetBatches() const
+{
+	return batches;
+}
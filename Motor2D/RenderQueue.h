@@ -0,0 +1,66 @@
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+
+#include "p2Defs.h"
+#include "Sprite.h"
+
+#include <vector>
+#include <map>
+
+using namespace std;
+
+#define RADIX_BITS 8
+#define SORT_Y_BIAS (1 << 23) //Negative positions are sorted too
+
+enum RENDER_LAYER
+{
+	LAYER_SPRITES,
+	LAYER_PRIORITY,
+	LAYER_UI
+};
+
+struct RenderCommand
+{
+	uint64 key; //Layer, y and texture, the sort order
+	RENDER_LAYER layer;
+	const Sprite* source; //Read when sorting, NULL if the sprite was copied
+	Sprite sprite;
+};
+
+// Sprites to draw this frame. Sorted with a radix sort on (layer, y, texture) so the ones with the same texture end
+// next to each other and are submitted together. The arrays are kept between frames
+class RenderQueue
+{
+public:
+
+	RenderQueue();
+
+	//The sprite is read when the queue is sorted
+	void Push(RENDER_LAYER layer, const Sprite* sprite);
+	//Copy of the sprite, drawn in the order pushed
+	void PushCopy(RENDER_LAYER layer, const Sprite& sprite);
+
+	void Sort();
+	//Draws the commands inside the camera. Returns the number of SDL copies made
+	uint Submit(SDL_Renderer* renderer, const SDL_Rect& camera);
+	void Clear();
+
+	uint Size() const;
+	uint GetBatches() const; //Runs of commands with the same texture in the last submit
+
+private:
+
+	uint GetTextureIndex(SDL_Texture* texture);
+	static uint64 MakeKey(RENDER_LAYER layer, int order, uint texture);
+
+private:
+
+	vector<RenderCommand> commands;
+	vector<RenderCommand> buffer; //Radix sort ping pong
+	map<SDL_Texture*, uint> textures; //Frame index of each texture
+
+	uint sequence; //Push order of the copies, they are sorted by it instead of y
+	uint batches;
+};
+
+#endif // __RENDERQUEUE_H__
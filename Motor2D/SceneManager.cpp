@@ -11,6 +11,7 @@
 #include "DevScene.h"
 #include "CreditScene.h"
 #include "InputManager.h"
+#include "j1AssetLoader.h"
 
 SceneManager::SceneManager() : j1Module()
 {
@@ -38,6 +39,42 @@ bool SceneManager::Awake(pugi::xml_node& conf)
 	//Disable dev_scene
 	App->dev_scene->DisableModule();
 
+	//Assets to load while the previous scene is still running
+	for (pugi::xml_node preload = conf.child("preload"); preload; preload = preload.next_sibling("preload"))
+	{
+		string scene = preload.attribute("scene").as_string();
+		SCENES id = (scene == "game") ? GAME : (scene == "dev") ? DEV : (scene == "credit") ? CREDIT : MENU;
+
+		for (pugi::xml_node asset = preload.first_child(); asset; asset = asset.next_sibling())
+		{
+			ScenePreload item;
+			string type = asset.name();
+
+			if (type == "texture")
+			{
+				item.type = ASSET_TEXTURE;
+				item.path = asset.attribute("path").as_string();
+			}
+			else if (type == "fx")
+			{
+				item.type = ASSET_FX;
+				item.path = asset.attribute("path").as_string();
+			}
+			else if (type == "map")
+			{
+				item.type = ASSET_MAP;
+				item.path = asset.attribute("file").as_string();
+			}
+			else
+			{
+				LOG("Unknown asset type %s in the preload of %s", type.data(), scene.data());
+				continue;
+			}
+
+			preloads[id].push_back(item);
+		}
+	}
+
 	return ret;
 }
 
@@ -69,11 +106,15 @@ bool SceneManager::PostUpdate()
 {
 	bool ret = true;
 
-	if (changing_scene == true)
+	//The old scene keeps running until the new one has its assets
+	if (changing_scene == true && IsPreloaded())
 	{
 		DisableScene(actual_scene);
 		EnableScene(new_scene);
 
+		//The scene has its own references now
+		ReleasePreload();
+
 		actual_scene = new_scene;
 		changing_scene = false;
 	}
@@ -86,6 +127,7 @@ bool SceneManager::CleanUp()
 {
 	LOG("Freeing Scene Manager");
 
+	ReleasePreload();
 
 
 	return true;
@@ -93,11 +135,61 @@ bool SceneManager::CleanUp()
 
 void SceneManager::WantToChangeScene(SCENES scene)
 {
+	if (changing_scene == false || new_scene != scene)
+		PreloadScene(scene);
+
 	changing_scene = true;
 
 	new_scene = scene;
 }
 
+void SceneManager::PreloadScene(SCENES scene)
+{
+	map<SCENES, vector<ScenePreload>>::iterator preload = preloads.find(scene);
+	if (preload == preloads.end())
+		return;
+
+	for (vector<ScenePreload>::iterator asset = preload->second.begin(); asset != preload->second.end(); ++asset)
+	{
+		uint handle = 0;
+
+		switch (asset->type)
+		{
+		case ASSET_TEXTURE:
+			handle = App->loader->LoadTexture(asset->path.data());
+			break;
+		case ASSET_FX:
+			handle = App->loader->LoadFx(asset->path.data());
+			break;
+		case ASSET_MAP:
+			handle = App->loader->PreloadMap(asset->path.data());
+			break;
+		}
+
+		if (handle != 0)
+			loading.push_back(handle);
+	}
+}
+
+bool SceneManager::IsPreloaded() const
+{
+	for (vector<uint>::const_iterator handle = loading.begin(); handle != loading.end(); ++handle)
+	{
+		if (App->loader->IsReady(*handle) == false)
+			return false;
+	}
+
+	return true;
+}
+
+void SceneManager::ReleasePreload()
+{
+	for (vector<uint>::iterator handle = loading.begin(); handle != loading.end(); ++handle)
+		App->loader->Release(*handle);
+
+	loading.clear();
+}
+
 void SceneManager::DisableScene(SCENES scene)
 {
 	switch (scene)
@@ -2,6 +2,9 @@
 #define __SCENE_MANAGER_H__
 
 #include "j1Module.h"
+#include "j1AssetLoader.h"
+
+#include <vector>
 
 enum SCENES
 {
@@ -11,6 +14,13 @@ enum SCENES
 	DEV
 };
 
+//Asset read in the background before its scene is enabled
+struct ScenePreload
+{
+	ASSET_TYPE	type;
+	string		path;
+};
+
 
 class SceneManager : public j1Module
 {
@@ -46,6 +56,10 @@ public:
 
 private:
 
+	void PreloadScene(SCENES scene);
+	bool IsPreloaded() const;
+	void ReleasePreload();
+
 	void DisableScene(SCENES scene);
 	void EnableScene(SCENES scene);
 
@@ -75,6 +89,9 @@ private:
 	SCENES actual_scene; //Scene that we are now
 	SCENES new_scene; //Scene that we want to load
 
+	map<SCENES, vector<ScenePreload>> preloads;
+	vector<uint> loading; //Handles of the assets of new_scene
+
 
 };
 
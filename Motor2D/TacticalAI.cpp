@@ -9,6 +9,8 @@
 #include "j1Map.h"
 #include "GameScene.h"
 
+#include <algorithm>
+
 TacticalAI::TacticalAI() : j1Module()
 {
 	name.append("tactical_ai");
@@ -39,10 +41,11 @@ bool TacticalAI::CleanUp()
 
 bool TacticalAI::Update(float dt)
 {
+	//Cheap with the sight caches, every frame to not miss anyone
+	Vision();
+
 	if (actual_time >= checks)
 	{
-		Vision();
-
 		CheckCollisions();
 
 		actual_time = 0;
@@ -167,7 +170,7 @@ void TacticalAI::SetEvent(UNIT_EVENT unit_event, Unit* unit, Unit* target){
 
 				else
 				{
-					uint path_id = App->pathfinding->CreatePath(path.front(), path.back());
+					uint path_id = App->pathfinding->CreatePath(path.front(), path.back(), PATH_PATROL, unit);
 					if (path_id != -1)
 						unit->SetPathId(path_id);
 				}
@@ -199,7 +202,7 @@ void TacticalAI::SetEvent(UNIT_EVENT unit_event, Unit* unit, Unit* target){
 
 					else
 					{
-						uint path_id = App->pathfinding->CreatePath(path.front(), path.back());
+						uint path_id = App->pathfinding->CreatePath(path.front(), path.back(), PATH_PATROL, unit);
 						if (path_id != -1)
 							unit->SetPathId(path_id);
 					}
@@ -220,11 +223,11 @@ void TacticalAI::SetEvent(UNIT_EVENT unit_event, Unit* unit, Unit* target){
 
 		if (unit->is_enemy == true)
 		{
-			enemy_found = SearchNearEnemyUnit(unit, App->entity->friendly_units);
+			enemy_found = SearchNearEnemyUnit(unit, App->entity->friendly_grid);
 		}
 		else
 		{
-			enemy_found = SearchNearEnemyUnit(unit, App->entity->enemy_units);
+			enemy_found = SearchNearEnemyUnit(unit, App->entity->enemy_grid);
 		}
 		
 		if (enemy_found == false)
@@ -249,7 +252,7 @@ void TacticalAI::SetEvent(UNIT_EVENT unit_event, Unit* unit, Unit* target){
 
 					else
 					{
-						uint path_id = App->pathfinding->CreatePath(path.front(), path.back());
+						uint path_id = App->pathfinding->CreatePath(path.front(), path.back(), PATH_PATROL, unit);
 						if (path_id != -1)
 							unit->SetPathId(path_id);
 					}
@@ -271,7 +274,7 @@ void TacticalAI::SetEvent(UNIT_EVENT unit_event, Unit* unit, Unit* target){
 		if (unit->is_enemy)
 		{
 			//Check if someone is near and attack
-			if (SearchNearEnemyUnit(unit, App->entity->friendly_units) == false)
+			if (SearchNearEnemyUnit(unit, App->entity->friendly_grid) == false)
 			{
 				//No one is near, chase my target
 				CalculatePath(unit, target);
@@ -284,7 +287,7 @@ void TacticalAI::SetEvent(UNIT_EVENT unit_event, Unit* unit, Unit* target){
 		}
 		else
 		{
-			if (SearchNearEnemyUnit(unit, App->entity->enemy_units) == false)
+			if (SearchNearEnemyUnit(unit, App->entity->enemy_grid) == false)
 			{
 				//No one is near, chase my target
 				CalculatePath(unit, target);
@@ -322,7 +325,7 @@ bool TacticalAI::CalculatePath(Unit* unit, Unit* target)
 	else
 	{
 		//Create pathfinding
-		uint path_id = App->pathfinding->CreatePath(unit_map, target_map);
+		uint path_id = App->pathfinding->CreatePath(unit_map, target_map, PATH_CHASE, unit);
 		if (path_id == -1)
 		{
 			LOG("Impossible to create path");
@@ -337,25 +340,32 @@ bool TacticalAI::CalculatePath(Unit* unit, Unit* target)
 	return true; 
 }
 
-bool TacticalAI::SearchNearEnemyUnit(Unit* unit, list<Unit*> search_list)
+//Dying or invisible units can't be targeted, they are left out before picking the nearest
+static bool IsTargetable(const Unit* unit)
+{
+	return unit->state != UNIT_DIE && unit->IsVisible() == true;
+}
+
+bool TacticalAI::SearchNearEnemyUnit(Unit* unit, const UnitGrid& grid)
 {
 	bool ret = false;
-	list<Unit*>::iterator i = search_list.begin();
 
-	while (i != search_list.end())
+	//Nearest first
+	vector<Unit*> candidates;
+	grid.QueryNearest(unit->GetPosition(), NEAREST_CANDIDATES, unit->GetRange(), candidates, IsTargetable);
+	vector<Unit*>::iterator i = candidates.begin();
+
+	while (i != candidates.end())
 	{
-		if ((*i)->state != UNIT_DIE && (*i)->IsVisible() == true)
+		if ((*i)->GetPosition().DistanceTo(unit->GetPosition()) < unit->GetRange()) //Change range by vision range and maybe start pathfinding
 		{
-			if ((*i)->GetPosition().DistanceTo(unit->GetPosition()) < unit->GetRange()) //Change range by vision range and maybe start pathfinding
-			{
 
-				if (unit->is_enemy)
-					LOG("Enemy: I've killed one enemy and another is near");
-				else
-					LOG("Friend: I've killed one enemy and another is near");
-				SetEvent(ENEMY_TARGET, unit, (*i));
-				return true;
-			}
+			if (unit->is_enemy)
+				LOG("Enemy: I've killed one enemy and another is near");
+			else
+				LOG("Friend: I've killed one enemy and another is near");
+			SetEvent(ENEMY_TARGET, unit, (*i));
+			return true;
 		}
 		++i;
 	}
@@ -364,50 +374,102 @@ bool TacticalAI::SearchNearEnemyUnit(Unit* unit, list<Unit*> search_list)
 }
 
 
+struct LeftCollider
+{
+	bool operator()(const CollisionEntry& a, const CollisionEntry& b) const
+	{
+		return a.collider.x < b.collider.x;
+	}
+};
+
+//Friendly pairs, then friendly-enemy, then enemy pairs. Each group in list order
+struct CollisionOrder
+{
+	CollisionOrder(uint num_friendly) : num_friendly(num_friendly)
+	{}
+
+	uint Group(const CollisionPair& pair) const
+	{
+		return (pair.index_a >= num_friendly) ? 2 : (pair.index_b >= num_friendly) ? 1 : 0;
+	}
+
+	bool operator()(const CollisionPair& a, const CollisionPair& b) const
+	{
+		if (Group(a) != Group(b))
+			return Group(a) < Group(b);
+		if (a.index_a != b.index_a)
+			return a.index_a < b.index_a;
+		return a.index_b < b.index_b;
+	}
+
+	uint num_friendly;
+};
+
 void TacticalAI::CheckCollisions()
 {
-	CheckCollisionsLists(App->entity->friendly_units, App->entity->friendly_units);
-	CheckCollisionsLists(App->entity->friendly_units, App->entity->enemy_units);
-	CheckCollisionsLists(App->entity->enemy_units, App->entity->enemy_units);
+	collision_entries.clear();
+	AddCollisionEntries(App->entity->friendly_units);
+	num_friendly = collision_entries.size();
+	AddCollisionEntries(App->entity->enemy_units);
+
+	FindCollisionPairs();
+
+	vector<CollisionPair>::iterator pair = collision_pairs.begin();
+	while (pair != collision_pairs.end())
+	{
+		//Checked here because separating a pair changes the state of its units
+		if (pair->unit_a->avoid_change_state == false && pair->unit_b->avoid_change_state == false)
+		{
+			if (pair->unit_a->state != UNIT_DIE && pair->unit_b->state != UNIT_DIE)
+				SeparateUnits(pair->unit_a, pair->unit_b);
+		}
+		++pair;
+	}
+}
+
+void TacticalAI::AddCollisionEntries(const list<Unit*>& units)
+{
+	list<Unit*>::const_iterator unit = units.begin();
+	while (unit != units.end())
+	{
+		CollisionEntry entry;
+		entry.unit = *unit;
+		entry.collider = (*unit)->GetCollider();
+		entry.index = collision_entries.size();
+		collision_entries.push_back(entry);
+		++unit;
+	}
 }
 
-void TacticalAI::CheckCollisionsLists(list<Unit*> list_a, list<Unit*> list_b)
+void TacticalAI::FindCollisionPairs()
 {
-	list<Unit*>::iterator unit_a = list_a.begin();
-	int count_a = 1;
+	collision_pairs.clear();
 
-	while (unit_a != list_a.end())
+	sort(collision_entries.begin(), collision_entries.end(), LeftCollider());
+
+	for (uint i = 0; i < collision_entries.size(); ++i)
 	{
-		list<Unit*>::iterator unit_b = list_b.begin();
-		int count_b = 1;
-		while (unit_b != list_b.end())
+		const CollisionEntry& a = collision_entries[i];
+
+		//Only the next colliders that start before this one ends can overlap it
+		for (uint j = i + 1; j < collision_entries.size() && collision_entries[j].collider.x <= a.collider.x + a.collider.w; ++j)
 		{
-			if (count_a >= count_b)	//Avoids duplicate searches
-			{
-				++count_b;
-				++unit_b;
-				continue;
-			}
-			//First check if someone is resolving collisions
-			if ((*unit_a)->avoid_change_state == false && (*unit_b)->avoid_change_state == false) 
+			const CollisionEntry& b = collision_entries[j];
+
+			if (OverlapRectangles(a.collider, b.collider))
 			{
-				if ((*unit_a)->state == UNIT_DIE || (*unit_b)->state == UNIT_DIE)
-				{
-					++count_b;
-					++unit_b;
-					continue;
-				}
-				if (OverlapRectangles((*unit_a)->GetCollider(), (*unit_b)->GetCollider()))
-				{
-					SeparateUnits(*unit_a, *unit_b);
-				}
+				CollisionPair pair;
+				bool a_first = a.index < b.index;
+				pair.unit_a = a_first ? a.unit : b.unit;
+				pair.unit_b = a_first ? b.unit : a.unit;
+				pair.index_a = a_first ? a.index : b.index;
+				pair.index_b = a_first ? b.index : a.index;
+				collision_pairs.push_back(pair);
 			}
-			++count_b;
-			++unit_b;
 		}
-		++count_a;
-		++unit_a;
 	}
+
+	sort(collision_pairs.begin(), collision_pairs.end(), CollisionOrder(num_friendly));
 }
 
 void TacticalAI::SeparateUnits(Unit* unit_a, Unit* unit_b)
@@ -464,57 +526,34 @@ void TacticalAI::SeparateUnits(Unit* unit_a, Unit* unit_b)
 
 void TacticalAI::Vision()
 {
-	//Check every x seconds if one unit is close to another
-	list<Unit*>::iterator unit_f = App->entity->friendly_units.begin();
+	list<Unit*>::iterator unit_e = App->entity->enemy_units.begin();
 
-	while (unit_f != App->entity->friendly_units.end())
+	while (unit_e != App->entity->enemy_units.end())
 	{
+		if ((*unit_e)->state == UNIT_DIE || (*unit_e)->IsVisible() == false)
+		{
+			++unit_e;
+			continue;
+		}
+
+		//Only the friendly units in its vision range
+		App->entity->friendly_grid.QueryRange((*unit_e)->GetPosition(), (*unit_e)->vision, units_in_range);
 
-		list<Unit*>::iterator unit_e = App->entity->enemy_units.begin();
-		while (unit_e != App->entity->enemy_units.end())
+		//Firebat enemy Uses Vision Cones
+		bool cone = (*unit_e)->type == FIREBAT;
+		if (cone && units_in_range.empty() == false)
+			UpdateSight(*unit_e);
+
+		vector<Unit*>::iterator unit_f = units_in_range.begin();
+		while (unit_f != units_in_range.end())
 		{
-			if ((*unit_f)->state != UNIT_DIE && (*unit_e)->state != UNIT_DIE && (*unit_f)->IsVisible() == true && (*unit_e)->IsVisible() == true)
+			if ((*unit_f)->state != UNIT_DIE && (*unit_f)->IsVisible() == true)
 			{
-				//If this doesn't work properly change distanceNoSqrt for distance(this uses a sqrt)
-				if ((*unit_f)->GetPosition().DistanceTo((*unit_e)->GetPosition()) <= (*unit_e)->vision)
+				if (cone)
 				{
-					//Firebat enemy Uses Vision Cones
-					if ((*unit_e)->type == FIREBAT)
-					{
-						fPoint distance((*unit_f)->GetPosition().x - (*unit_e)->GetPosition().x, (*unit_f)->GetPosition().y - (*unit_e)->GetPosition().y);
-						fPoint direction = (*unit_e)->GetDirection();
-						distance.Normalize();
-						direction.Normalize();
-
-						float dot_product = direction.x * distance.x + direction.y * distance.y;
-
-						float angle = acos(dot_product) * 180 / M_PI;
+					iPoint f_tile = App->map->WorldToMap((*unit_f)->GetPosition().x, (*unit_f)->GetPosition().y, COLLIDER_MAP);
 
-						if (angle < (30))
-						{
-							iPoint e_tile = App->map->WorldToMap((*unit_e)->GetPosition().x, (*unit_e)->GetPosition().y, COLLIDER_MAP);
-							iPoint f_tile = App->map->WorldToMap((*unit_f)->GetPosition().x, (*unit_f)->GetPosition().y, COLLIDER_MAP);
-
-							if (App->pathfinding->CreateLine(e_tile, f_tile) == true)
-							{
-
-								if ((*unit_f)->GetTarget() == NULL && (*unit_f)->type != MEDIC)
-								{
-									LOG("Friend: I've found someone near");
-									SetEvent(ENEMY_TARGET, *unit_f, *unit_e);
-								}
-
-								
-								if ((*unit_e)->type == FIREBAT)
-								{
-									App->game_scene->LoseGameDetected();
-									return;
-								}
-								
-							}
-						}
-					}
-					else //All other units use Cirlce Vision
+					if ((*unit_e)->sight.Sees(f_tile))
 					{
 						if ((*unit_f)->GetTarget() == NULL && (*unit_f)->type != MEDIC)
 						{
@@ -522,23 +561,43 @@ void TacticalAI::Vision()
 							SetEvent(ENEMY_TARGET, *unit_f, *unit_e);
 						}
 
-						if ((*unit_e)->GetTarget() == NULL)
-						{
-							LOG("Enemy: I've found someone near");
-							SetEvent(ENEMY_TARGET, *unit_e, *unit_f);
-						}
+						//Seen by a firebat
+						App->game_scene->LoseGameDetected();
+						return;
+					}
+				}
+				else //All other units use Cirlce Vision
+				{
+					if ((*unit_f)->GetTarget() == NULL && (*unit_f)->type != MEDIC)
+					{
+						LOG("Friend: I've found someone near");
+						SetEvent(ENEMY_TARGET, *unit_f, *unit_e);
 					}
 
-					
+					if ((*unit_e)->GetTarget() == NULL)
+					{
+						LOG("Enemy: I've found someone near");
+						SetEvent(ENEMY_TARGET, *unit_e, *unit_f);
+					}
 				}
-				
 			}
-			++unit_e;
+			++unit_f;
 		}
-		++unit_f;
+		++unit_e;
 	}
 }
 
+void TacticalAI::UpdateSight(Unit* unit)
+{
+	map<uint, MapData*>::iterator collider_map = App->map->maps.find(COLLIDER_MAP);
+	int tile_width = (collider_map != App->map->maps.end()) ? collider_map->second->tile_width : 1;
+
+	iPoint tile = App->map->WorldToMap(unit->GetPosition().x, unit->GetPosition().y, COLLIDER_MAP);
+	int radius = (unit->vision + tile_width - 1) / tile_width;
+
+	unit->sight.Update(tile, unit->GetDirection(), radius, unit->type == FIREBAT);
+}
+
 bool TacticalAI::OverlapRectangles(const SDL_Rect r1,const SDL_Rect r2)const
 {
 	if (r1.x + r1.w < r2.x || r1.x > r2.x + r2.w) 
@@ -5,8 +5,11 @@
 #include <list>
 #include <map>
 #include <queue>
+#include <vector>
+#include "p2Point.h"
 
 #define COLLISION_DISTANCE 15 //Radius of 'vital' space that every unit have to avoid collisons
+#define NEAREST_CANDIDATES 8 //Nearest units checked when searching a new target
 
 enum UNIT_EVENT{
 END_MOVING,
@@ -18,6 +21,24 @@ ENEMY_RUNNING
 };
 
 class Unit;
+class UnitGrid;
+
+//Unit in the collision sweep
+struct CollisionEntry
+{
+	Unit* unit;
+	SDL_Rect collider;
+	uint index; //Friendly units first, then the enemies, in list order
+};
+
+//Units whose colliders overlap. index_a < index_b
+struct CollisionPair
+{
+	Unit* unit_a;
+	Unit* unit_b;
+	uint index_a;
+	uint index_b;
+};
 
 class TacticalAI : public j1Module
 {
@@ -42,14 +63,17 @@ public:
 
 	//Calculates the path to the target
 	bool CalculatePath(Unit* unit, Unit* target);
+
+	void UpdateSight(Unit* unit); //Recomputes the tiles it sees if it moved or turned
 	
 private:
 	//Search near enemies and target them (enemy->friendly friendly->enemy)
-	bool SearchNearEnemyUnit(Unit* unit, list<Unit*> search_list);
+	bool SearchNearEnemyUnit(Unit* unit, const UnitGrid& grid);
 
 	//Collisions
 	void CheckCollisions(); //Only between units
-	void CheckCollisionsLists(list<Unit*> list_a, list<Unit*> list_b);
+	void AddCollisionEntries(const list<Unit*>& units);
+	void FindCollisionPairs(); //Sort and sweep on the collider x
 	void SeparateUnits(Unit* unit_a, Unit* unit_b);
 
 	void SeparateAtkUnits(Unit* unit, Unit* reference);
@@ -65,9 +89,16 @@ private:
 
 private:
 
-	//Check vision and collisions 5 times / sec
+	//Check collisions 8 times / sec
 	float checks = 0.12f;
 	float actual_time = 0;
+
+	//Collisions, kept between checks to reuse the memory
+	vector<CollisionEntry> collision_entries;
+	vector<CollisionPair> collision_pairs;
+	uint num_friendly = 0;
+
+	vector<Unit*> units_in_range; //Friendly units seen by the enemy being checked
 };
 
 
@@ -14,6 +14,7 @@
 #include "Bullet.h"
 #include "GameScene.h"
 #include"SceneManager.h"
+#include "TacticalAI.h"
 
 Unit::Unit() : Entity()
 {
@@ -271,73 +272,41 @@ void Unit::Draw()
 
 void Unit::DrawVisionCone()
 {
-	//Lateral Lines
-	fPoint left_vision(direction);
-	fPoint right_vision(left_vision);
-	left_vision.Rotate(M_PI / 6);
-	right_vision.Rotate(-M_PI / 6);
-	left_vision.Scale(vision);
-	right_vision.Scale(vision);
+	//The cone stops at the walls: draw the tiles the unit sees, merging each row in spans
+	App->tactical_ai->UpdateSight(this);
 
-	float angle1 = RADTODEG * atan2(left_vision.y, left_vision.x);
-	float angle2 = RADTODEG * atan2(right_vision.y, right_vision.x);
+	map<uint, MapData*>::iterator collider = App->map->maps.find(COLLIDER_MAP);
+	if (collider == App->map->maps.end() || sight.IsValid() == false)
+		return;
 
-	if (angle2 > angle1 && angle1 > 0)
-		App->render->DrawCircle(logic_pos.x, logic_pos.y, vision, 0, 255, 0, 255, true, angle1, angle2);
+	int tile_w = collider->second->tile_width;
+	int tile_h = collider->second->tile_height;
+	const iPoint& center = sight.GetTile();
+	int radius = sight.GetRadius();
 
-	else if (angle2 < 0 && angle1 > 0)
-	{
-		angle2 = angle1 + 60;
-		App->render->DrawCircle(logic_pos.x, logic_pos.y, vision, 0, 255, 0, 255, true, angle1, angle2);
-	}
+	SDL_Rect span;
+	span.h = tile_h;
 
-	else if (angle1 < 0 && angle2 > 0)
+	for (int y = center.y - radius; y <= center.y + radius; ++y)
 	{
-		angle1 = 360 + angle1;
-		angle2 = angle1 + 60;
-		App->render->DrawCircle(logic_pos.x, logic_pos.y, vision, 0, 255, 0, 255, true, angle1, angle2);
-	}
+		int start = -1;
+		for (int x = center.x - radius; x <= center.x + radius + 1; ++x)
+		{
+			bool seen = x <= center.x + radius && sight.Sees(iPoint(x, y));
 
-	else if (angle1 < 0 && angle2 < 0)
-	{
-		angle1 = 360 + angle1;
-		angle2 = 360 + angle2;
-		App->render->DrawCircle(logic_pos.x, logic_pos.y, vision, 0, 255, 0, 255, true, angle1, angle2);
+			if (seen && start == -1)
+				start = x;
+			else if (seen == false && start != -1)
+			{
+				iPoint pos = App->map->MapToWorld(start, y, COLLIDER_MAP);
+				span.x = pos.x;
+				span.y = pos.y;
+				span.w = (x - start) * tile_w;
+				App->render->DrawQuad(span, 0, 255, 0, 60);
+				start = -1;
+			}
+		}
 	}
-
-	left_vision.x += logic_pos.x;
-	left_vision.y += logic_pos.y;
-	right_vision.x += logic_pos.x;
-	right_vision.y += logic_pos.y;
-
-	App->render->DrawLine(logic_pos.x, logic_pos.y, left_vision.x, left_vision.y, 0, 255, 0);
-	App->render->DrawLine(logic_pos.x, logic_pos.y, right_vision.x, right_vision.y, 0, 255, 0);
-
-	/*fPoint origin(logic_pos.x, logic_pos.y);
-	vector<iPoint> open_points;
-	vector<ConePoint> key_points;
-
-	open_points= CollidersInsideConeVision(origin, right_vision, left_vision);
-
-
-	GetKeyPointsConeVision(open_points, key_points, origin);
-
-	//Add limits to key_points
-	ConePoint source(logic_pos); 
-	if (App->pathfinding->CreateLineWorld(logic_pos, iPoint(left_vision.x, left_vision.y)) == true)
-		source.point_a = iPoint(left_vision.x, left_vision.y);
-	else
-		source.point_a = App->pathfinding->GetLineWorld();
-	if (App->pathfinding->CreateLineWorld(logic_pos, iPoint(right_vision.x, right_vision.y)) == true)
-		source.point_b = iPoint(right_vision.x, right_vision.y);
-	else
-		source.point_b = App->pathfinding->GetLineWorld();
-
-	key_points.push_back(source);
-
-	//Draw key_points
-	ConnectKeyPoints(key_points);*/
-
 }
 
 void Unit::ConnectKeyPoints(vector<ConePoint>& list)
@@ -642,9 +611,9 @@ void Unit::ApplyDamage(uint dmg, Unit* source, Bullet* bullet)
 	if (bullet != NULL)
 	{
 		if (is_enemy)
-			AlertNearUnits(bullet->origin, App->entity->enemy_units);
+			AlertNearUnits(bullet->origin, App->entity->enemy_grid);
 		else
-			AlertNearUnits(bullet->origin, App->entity->friendly_units);
+			AlertNearUnits(bullet->origin, App->entity->friendly_grid);
 	}
 		
 	
@@ -715,7 +684,7 @@ void Unit::ApplyDamage(uint dmg, Unit* source, Bullet* bullet)
 				{
 					//Ignore attacking
 					LOG("A medic is about to heal me!");
-					App->audio->PlayFx(source->attack_fx);
+					App->audio->PlayFx(source->attack_fx, 0, FX_LOW);
 				}
 				else
 					App->tactical_ai->SetEvent(ATTACKED, this, source);
@@ -731,6 +700,8 @@ void Unit::Move(float dt)
 		//Need to wait for the path
 		if (App->pathfinding->PathFinished(path_id) == true)
 		{
+			partial_path = App->pathfinding->GetPathContinuation(path_id, path_goal);
+			path_priority = App->pathfinding->GetPathPriority(path_id);
 			AsignPath(App->pathfinding->GetPath(path_id));
 			waiting_for_path = false;
 		}
@@ -785,6 +756,17 @@ void Unit::Move(float dt)
 				path.erase(path.begin());
 				SetDirection();
 			}
+			else if (partial_path)
+			{
+				//Long path: ask for the next part from the end of this one
+				partial_path = false;
+				int next_id = App->pathfinding->CreatePath(iPoint(dst_point.x - path_offset_x, dst_point.y - path_offset_y), path_goal, path_priority, this);
+				if (next_id != -1)
+				{
+					path_id = next_id;
+					waiting_for_path = true;
+				}
+			}
 			else
 			{
 				//PATH COMPLETED!
@@ -823,7 +805,13 @@ void Unit::CenterUnit()
 
 void Unit::SetPath(vector<iPoint> _path)
 {	
+	//The new path replaces the one it was waiting for
+	if (waiting_for_path)
+		App->pathfinding->CancelPaths(this);
+
 	waiting_for_path = false;
+	partial_path = false;
+	recording_patrol = false;
 	has_destination = false;
 	path = _path;
 	state = UNIT_MOVE;
@@ -831,7 +819,13 @@ void Unit::SetPath(vector<iPoint> _path)
 
 void Unit::SetPathId(uint id)
 {
+	//A path shared with other units can replace the one it was waiting for
+	if (waiting_for_path && id != path_id)
+		App->pathfinding->CancelPaths(this, id);
+
 	waiting_for_path = true;
+	partial_path = false;
+	recording_patrol = false;
 	path.clear();
 	this->path_id = id;
 	has_destination = false;
@@ -876,7 +870,7 @@ void Unit::SetAnimation()
 {
 	if (state == UNIT_ATTACK)
 	{
-		App->audio->PlayFx(attack_fx);
+		App->audio->PlayFx(attack_fx, 0, FX_LOW);
 		if (target)
 		{
 			iPoint target_pos = target->GetPosition();
@@ -1148,11 +1142,13 @@ void Unit::CastAbility(const UNIT_ABILITY ability)
 {
 }
 
-void Unit::AlertNearUnits(iPoint destination, list<Unit*> search_list)
+void Unit::AlertNearUnits(iPoint destination, const UnitGrid& grid)
 {
-	
-	list<Unit*>::iterator unit = search_list.begin();
-	while (unit != search_list.end())
+	vector<Unit*> near_units;
+	grid.QueryRange(logic_pos, vision, near_units);
+
+	vector<Unit*>::iterator unit = near_units.begin();
+	while (unit != near_units.end())
 	{
 		if ((*unit)->GetPosition().DistanceManhattan(logic_pos) <= vision)
 		{
@@ -1171,7 +1167,7 @@ void Unit::AlertNearUnits(iPoint destination, list<Unit*> search_list)
 				}
 				else
 				{
-					uint u_path_id = App->pathfinding->CreatePath(unit_tile, dst_tile);
+					uint u_path_id = App->pathfinding->CreatePath(unit_tile, dst_tile, PATH_CHASE, *unit);
 					if (u_path_id != -1)
 					{
 						(*unit)->SetPathId(u_path_id);
@@ -1189,6 +1185,8 @@ void Unit::AlertNearUnits(iPoint destination, list<Unit*> search_list)
 
 void Unit::AsignPath(vector<iPoint> main_path)
 {
+	uint first_new = path.size();
+
 	vector<iPoint>::iterator it = main_path.begin();
 	while (it != main_path.end())
 	{
@@ -1196,10 +1194,17 @@ void Unit::AsignPath(vector<iPoint> main_path)
 		++it;
 	}
 
-	//PATROL
-	if (patrol && patrol_path.empty())
+	//PATROL: a long path arrives in parts, all of them are kept until the last one
+	if (patrol && (patrol_path.empty() || recording_patrol))
 	{
-		patrol_path = path;
+		vector<iPoint>::iterator first = path.begin() + first_new;
+
+		//Each part starts where the last one ended
+		if (patrol_path.empty() == false && first != path.end() && *first == patrol_path.back())
+			++first;
+
+		patrol_path.insert(patrol_path.end(), first, path.end());
+		recording_patrol = partial_path;
 	}
 }
 
@@ -6,6 +6,9 @@
 #include "p2Point.h"
 #include "Entity.h"
 #include "UIProgressBar.h"
+#include "PathSolverPool.h"
+#include "UnitGrid.h"
+#include "UnitSight.h"
 #include <vector>
 #include <queue>
 
@@ -119,7 +122,7 @@ private:
 	//AsignPath with offset
 	void AsignPath(vector<iPoint> main_path);
 
-	void AlertNearUnits(iPoint destination, list<Unit*> list); //Near units will go to destination point
+	void AlertNearUnits(iPoint destination, const UnitGrid& grid); //Near units will go to destination point
 
 	//Draw Vision Cone
 	void DrawVisionCone();
@@ -215,13 +218,24 @@ public:
 	int path_offset_x; //Offset to the original path
 	int path_offset_y;
 	bool waiting_for_path = false;
+	bool partial_path = false; //Only the first part of a long path was received
+	iPoint path_goal; //Final destination of a partial path
+	PATH_PRIORITY path_priority = PATH_PLAYER; //The next parts of a partial path keep it
 	//Patrol
 	bool patrol;
 	iPoint original_point;
 	fPoint original_direction;
 	vector<iPoint> patrol_path;
+	bool recording_patrol = false; //patrol_path is still receiving the parts of a long path
 
 	//Attacking
 	float cool_timer = 0;
+
+	//Spatial grid
+	iPoint grid_cell;
+	bool in_grid = false;
+
+	//Tiles seen, only recomputed when it moves or turns
+	UnitSight sight;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "UnitGrid.h"
+#include "Unit.h"
+
+#include <algorithm>
+
+UnitGrid::UnitGrid() : size(0), max_extent(0)
+{}
+
+iPoint UnitGrid::GetCell(const iPoint& position) const
+{
+	//Floor division, positions can be negative
+	iPoint cell;
+	cell.x = (position.x >= 0) ? position.x / GRID_CELL_SIZE : (position.x - GRID_CELL_SIZE + 1) / GRID_CELL_SIZE;
+	cell.y = (position.y >= 0) ? position.y / GRID_CELL_SIZE : (position.y - GRID_CELL_SIZE + 1) / GRID_CELL_SIZE;
+
+	return cell;
+}
+
+uint UnitGrid::GetBucket(const iPoint& cell) const
+{
+	uint hash = ((uint)cell.x * 73856093u) ^ ((uint)cell.y * 19349663u);
+	return hash % GRID_BUCKETS;
+}
+
+void UnitGrid::Insert(Unit* unit)
+{
+	if (unit->in_grid)
+		return;
+
+	unit->grid_cell = GetCell(unit->GetPosition());
+	unit->in_grid = true;
+	buckets[GetBucket(unit->grid_cell)].push_back(unit);
+
+	SDL_Rect collider = unit->GetCollider();
+	max_extent = MAX(max_extent, MAX(MAX(unit->width, unit->height), MAX(collider.w, collider.h)));
+	++size;
+}
+
+void UnitGrid::Remove(Unit* unit)
+{
+	if (unit->in_grid == false)
+		return;
+
+	vector<Unit*>& bucket = buckets[GetBucket(unit->grid_cell)];
+	vector<Unit*>::iterator it = find(bucket.begin(), bucket.end(), unit);
+
+	if (it != bucket.end())
+	{
+		//Order doesn't matter, swap with the last one
+		*it = bucket.back();
+		bucket.pop_back();
+		--size;
+	}
+
+	unit->in_grid = false;
+}
+
+void UnitGrid::Update(Unit* unit)
+{
+	if (unit->in_grid == false)
+	{
+		Insert(unit);
+		return;
+	}
+
+	iPoint cell = GetCell(unit->GetPosition());
+
+	if (cell != unit->grid_cell)
+	{
+		Remove(unit);
+		Insert(unit);
+	}
+}
+
+void UnitGrid::Clear()
+{
+	for (uint i = 0; i < GRID_BUCKETS; ++i)
+	{
+		vector<Unit*>::iterator unit = buckets[i].begin();
+		while (unit != buckets[i].end())
+		{
+			(*unit)->in_grid = false;
+			++unit;
+		}
+		buckets[i].clear();
+	}
+
+	size = 0;
+	max_extent = 0;
+}
+
+uint UnitGrid::Size() const
+{
+	return size;
+}
+
+int UnitGrid::GetMaxExtent() const
+{
+	return max_extent;
+}
+
+void UnitGrid::AddCellUnits(const iPoint& cell, const iPoint& center, int radius, vector<Unit*>& result, UnitFilter filter) const
+{
+	const vector<Unit*>& bucket = buckets[GetBucket(cell)];
+
+	vector<Unit*>::const_iterator unit = bucket.begin();
+	while (unit != bucket.end())
+	{
+		//Other cells can share the bucket
+		if ((*unit)->grid_cell == cell && (*unit)->GetPosition().DistanceTo(center) <= radius && (filter == NULL || filter(*unit)))
+			result.push_back(*unit);
+		++unit;
+	}
+}
+
+void UnitGrid::QueryRange(const iPoint& center, int radius, vector<Unit*>& result) const
+{
+	result.clear();
+
+	iPoint min_cell = GetCell(iPoint(center.x - radius, center.y - radius));
+	iPoint max_cell = GetCell(iPoint(center.x + radius, center.y + radius));
+
+	for (int y = min_cell.y; y <= max_cell.y; ++y)
+		for (int x = min_cell.x; x <= max_cell.x; ++x)
+			AddCellUnits(iPoint(x, y), center, radius, result);
+}
+
+void UnitGrid::QueryRect(const SDL_Rect& rect, vector<Unit*>& result) const
+{
+	result.clear();
+
+	iPoint min_cell = GetCell(iPoint(rect.x, rect.y));
+	iPoint max_cell = GetCell(iPoint(rect.x + rect.w, rect.y + rect.h));
+
+	for (int y = min_cell.y; y <= max_cell.y; ++y)
+	{
+		for (int x = min_cell.x; x <= max_cell.x; ++x)
+		{
+			iPoint cell(x, y);
+			const vector<Unit*>& bucket = buckets[GetBucket(cell)];
+
+			vector<Unit*>::const_iterator unit = bucket.begin();
+			while (unit != bucket.end())
+			{
+				if ((*unit)->grid_cell == cell && (*unit)->GetPosition().PointInRect(rect.x, rect.y, rect.w, rect.h))
+					result.push_back(*unit);
+				++unit;
+			}
+		}
+	}
+}
+
+struct NearerTo
+{
+	NearerTo(const iPoint& center) : center(center)
+	{}
+
+	bool operator()(const Unit* a, const Unit* b) const
+	{
+		return a->GetPosition().DistanceNoSqrt(center) < b->GetPosition().DistanceNoSqrt(center);
+	}
+
+	iPoint center;
+};
+
+void UnitGrid::QueryNearest(const iPoint& center, uint k, int max_distance, vector<Unit*>& result, UnitFilter filter) const
+{
+	result.clear();
+
+	if (k == 0 || size == 0)
+		return;
+
+	iPoint center_cell = GetCell(center);
+	int max_ring = max_distance / GRID_CELL_SIZE + 1;
+
+	//Rings of cells around the center. Units of the ring r + 1 are at r * GRID_CELL_SIZE or more
+	for (int ring = 0; ring <= max_ring; ++ring)
+	{
+		for (int y = center_cell.y - ring; y <= center_cell.y + ring; ++y)
+		{
+			//Only the border of the square is new
+			int step = (y == center_cell.y - ring || y == center_cell.y + ring) ? 1 : MAX(2 * ring, 1);
+
+			for (int x = center_cell.x - ring; x <= center_cell.x + ring; x += step)
+				AddCellUnits(iPoint(x, y), center, max_distance, result, filter);
+		}
+
+		if (result.size() >= k || result.size() == size)
+		{
+			sort(result.begin(), result.end(), NearerTo(center));
+
+			if (result.size() == size || result[k - 1]->GetPosition().DistanceTo(center) <= ring * GRID_CELL_SIZE)
+				break;
+		}
+	}
+
+	sort(result.begin(), result.end(), NearerTo(center));
+
+	if (result.size() > k)
+		result.resize(k);
+}
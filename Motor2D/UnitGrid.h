@@ -0,0 +1,56 @@
+#ifndef __UNITGRID_H__
+#define __UNITGRID_H__
+
+#include "p2Defs.h"
+#include "p2Point.h"
+#include "SDL\include\SDL_rect.h"
+
+#include <vector>
+
+using namespace std;
+
+#define GRID_CELL_SIZE 128 //World pixels per cell side
+#define GRID_BUCKETS 256 //Cells are hashed, the world size doesn't need to be known
+
+class Unit;
+
+typedef bool (*UnitFilter)(const Unit* unit); //Units it returns false for are left out of a query
+
+// Spatial hash of units by their logic position. The units remember their cell, Update() only moves the ones that changed of cell
+class UnitGrid
+{
+public:
+
+	UnitGrid();
+
+	void Insert(Unit* unit);
+	void Remove(Unit* unit);
+	void Update(Unit* unit); //Inserts it if it wasn't in the grid
+	void Clear();
+
+	uint Size() const;
+	int GetMaxExtent() const; //Biggest width, height or collider side of the units inserted
+
+	//Units at radius or less from center
+	void QueryRange(const iPoint& center, int radius, vector<Unit*>& result) const;
+	//Units with the position inside the rect
+	void QueryRect(const SDL_Rect& rect, vector<Unit*>& result) const;
+	//The k nearest units at max_distance or less that pass the filter, nearest first
+	void QueryNearest(const iPoint& center, uint k, int max_distance, vector<Unit*>& result, UnitFilter filter = NULL) const;
+
+private:
+
+	iPoint GetCell(const iPoint& position) const;
+	uint GetBucket(const iPoint& cell) const;
+
+	//Adds the units of the cell that pass the filter
+	void AddCellUnits(const iPoint& cell, const iPoint& center, int radius, vector<Unit*>& result, UnitFilter filter = NULL) const;
+
+private:
+
+	vector<Unit*> buckets[GRID_BUCKETS];
+	uint size;
+	int max_extent;
+};
+
+#endif // __UNITGRID_H__
@@ -0,0 +1,78 @@
+#include "UnitSight.h"
+#include "j1App.h"
+#include "j1Pathfinding.h"
+#include "FieldOfView.h"
+
+UnitSight::UnitSight() : valid(false), radius(0), cone(false)
+{}
+
+bool UnitSight::Update(const iPoint& tile, const fPoint& direction, int radius, bool cone)
+{
+	//Circles don't depend on the direction
+	if (valid && tile == this->tile && radius == this->radius && cone == this->cone && (cone == false || direction == this->direction))
+		return false;
+
+	this->tile = tile;
+	this->direction = direction;
+	this->radius = radius;
+	this->cone = cone;
+
+	Compute();
+	valid = true;
+
+	return true;
+}
+
+void UnitSight::Invalidate()
+{
+	valid = false;
+}
+
+bool UnitSight::Sees(const iPoint& tile) const
+{
+	if (valid == false)
+		return false;
+
+	int x = tile.x - this->tile.x + radius;
+	int y = tile.y - this->tile.y + radius;
+	int side = 2 * radius + 1;
+
+	if (x < 0 || y < 0 || x >= side || y >= side)
+		return false;
+
+	return visible[y * side + x];
+}
+
+bool UnitSight::IsValid() const
+{
+	return valid;
+}
+
+const iPoint& UnitSight::GetTile() const
+{
+	return tile;
+}
+
+int UnitSight::GetRadius() const
+{
+	return radius;
+}
+
+void UnitSight::Compute()
+{
+	const WalkabilityMap* map = App->pathfinding->GetWalkabilityMap();
+
+	if (map == NULL)
+	{
+		int side = 2 * radius + 1;
+		visible.assign(side * side, false);
+		return;
+	}
+
+	FieldOfView fov(*map);
+
+	if (cone)
+		fov.ComputeCone(tile, radius, direction, CONE_HALF_ANGLE, visible);
+	else
+		fov.ComputeCircle(tile, radius, visible);
+}
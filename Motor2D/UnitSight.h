@@ -0,0 +1,46 @@
+#ifndef __UNITSIGHT_H__
+#define __UNITSIGHT_H__
+
+#include "p2Defs.h"
+#include "p2Point.h"
+
+#include <vector>
+
+using namespace std;
+
+#define CONE_HALF_ANGLE 30 //Degrees at each side of the direction
+
+// Tiles a unit can see from its tile, kept until the unit changes of tile or turns
+class UnitSight
+{
+public:
+
+	UnitSight();
+
+	//Recomputes the visible tiles if anything changed. radius in tiles, cone only sees in front of direction
+	//Returns true if it was recomputed
+	bool Update(const iPoint& tile, const fPoint& direction, int radius, bool cone);
+	void Invalidate();
+
+	bool Sees(const iPoint& tile) const;
+	bool IsValid() const;
+	const iPoint& GetTile() const;
+	int GetRadius() const;
+
+private:
+
+	void Compute();
+
+private:
+
+	bool valid;
+	iPoint tile;
+	fPoint direction;
+	int radius;
+	bool cone;
+
+	//Visibility of the square of side 2 * radius + 1 centered in tile
+	vector<bool> visible;
+};
+
+#endif // __UNITSIGHT_H__
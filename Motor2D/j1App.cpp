@@ -24,6 +24,7 @@
 #include "DevScene.h"
 #include "CreditScene.h"
 #include "InputManager.h"
+#include "j1AssetLoader.h"
 
 
 // Constructor
@@ -50,6 +51,7 @@ j1App::j1App(int argc, char* args[]) : argc(argc), args(args)
 	dev_scene = new DevScene();
 	credit_scene = new CreditScene();
 	input_manager = new InputManager();
+	loader = new j1AssetLoader();
 
 	// Ordered for awake / Start / Update
 	// Reverse order of CleanUp
@@ -59,6 +61,7 @@ j1App::j1App(int argc, char* args[]) : argc(argc), args(args)
 	AddModule(tex);
 	AddModule(audio);
 	AddModule(map);
+	AddModule(loader);
 	AddModule(pathfinding);
 	AddModule(font);
 	AddModule(ui);
@@ -208,15 +211,7 @@ pugi::xml_node j1App::LoadConfig(pugi::xml_document& config_file) const
 {
 	pugi::xml_node ret;
 
-	char* buf;
-	int size = App->fs->Load("config.xml", &buf);
-	pugi::xml_parse_result result = config_file.load_buffer(buf, size);
-	delete[] buf;
-	buf = NULL;
-
-	if(result == NULL)
-		LOG("Could not load map xml file config.xml. pugi error: %s", result.description());
-	else
+	if(App->fs->LoadXML("config.xml", config_file))
 		ret = config_file.child("config");
 
 	return ret;
@@ -29,6 +29,7 @@ class SceneManager;
 class DevScene;
 class CreditScene;
 class InputManager;
+class j1AssetLoader;
 
 class j1App
 {
@@ -112,6 +113,7 @@ public:
 	DevScene*			dev_scene = NULL;
 	CreditScene*		credit_scene = NULL;
 	InputManager*		input_manager = NULL;
+	j1AssetLoader*		loader = NULL;
 
 private:
 
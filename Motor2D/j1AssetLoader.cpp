@@ -0,0 +1,440 @@
+#include "p2Defs.h"
+#include "p2Log.h"
+#include "j1App.h"
+#include "j1FileSystem.h"
+#include "j1Textures.h"
+#include "j1Audio.h"
+#include "j1Map.h"
+#include "j1PerfTimer.h"
+#include "PackArchive.h"
+#include "j1AssetLoader.h"
+
+#include "SDL/include/SDL.h"
+#include "SDL_image/include/SDL_image.h"
+#include "SDL_mixer\include\SDL_mixer.h"
+
+#include <string.h>
+
+j1AssetLoader::j1AssetLoader() : j1Module(), next_handle(1), batch_total(0), batch_done(0), running(false), num_threads(DEFAULT_LOADER_THREADS), upload_budget(DEFAULT_UPLOAD_BUDGET)
+{
+	name.append("asset_loader");
+}
+
+// Destructor
+j1AssetLoader::~j1AssetLoader()
+{}
+
+// Called before render is available
+bool j1AssetLoader::Awake(pugi::xml_node& config)
+{
+	LOG("Loading Asset Loader");
+
+	num_threads = config.attribute("threads").as_uint(DEFAULT_LOADER_THREADS);
+	upload_budget = config.attribute("upload_budget_us").as_double(DEFAULT_UPLOAD_BUDGET);
+
+	//Without threads the requests are decoded in PreUpdate
+	running = true;
+	for (uint i = 0; i < num_threads; ++i)
+		workers.push_back(thread(&j1AssetLoader::WorkerLoop, this));
+
+	return true;
+}
+
+// Called before all Updates
+bool j1AssetLoader::PreUpdate()
+{
+	if (workers.empty())
+	{
+		//Nobody else will decode them
+		while (queued.empty() == false)
+		{
+			AssetRequest* request = queued.front();
+			queued.pop_front();
+			Decode(request);
+			decoded.push_back(request);
+		}
+	}
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		while (decoded.empty() == false)
+		{
+			decoded.front()->state = ASSET_DECODED;
+			finishing.push_back(decoded.front());
+			decoded.pop_front();
+		}
+	}
+
+	//At least one each frame, so a slow upload can't stall the loading
+	j1PerfTimer timer;
+	while (finishing.empty() == false)
+	{
+		AssetRequest* request = finishing.front();
+		finishing.pop_front();
+		Finish(request);
+
+		if (timer.ReadMs() * 1000.0 >= upload_budget)
+			break;
+	}
+
+	return true;
+}
+
+// Called before quitting
+bool j1AssetLoader::CleanUp()
+{
+	LOG("Freeing Asset Loader");
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		running = false;
+	}
+	wake.notify_all();
+
+	for (vector<thread>::iterator worker = workers.begin(); worker != workers.end(); ++worker)
+		worker->join();
+	workers.clear();
+
+	queued.clear();
+	decoded.clear();
+	finishing.clear();
+
+	//Textures and fx already created belong to their modules, they free them on their own
+	for (map<uint, AssetRequest*>::iterator request = requests.begin(); request != requests.end(); ++request)
+	{
+		Free(request->second);
+		RELEASE(request->second);
+	}
+	requests.clear();
+
+	batch_total = batch_done = 0;
+
+	return true;
+}
+
+uint j1AssetLoader::LoadTexture(const char* path)
+{
+	AssetRequest* request = CreateRequest(ASSET_TEXTURE, path);
+
+	//Already in memory, only needs a new reference
+	if (App->tex->IsLoaded(path))
+	{
+		request->texture = App->tex->Load(path);
+		request->state = ASSET_READY;
+		++batch_done;
+		return request->handle;
+	}
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		queued.push_back(request);
+	}
+	wake.notify_one();
+
+	return request->handle;
+}
+
+uint j1AssetLoader::LoadFx(const char* path)
+{
+	if (App->audio->active == false)
+		return 0;
+
+	AssetRequest* request = CreateRequest(ASSET_FX, path);
+
+	request->fx = App->audio->GetFx(path);
+	if (request->fx != 0)
+	{
+		request->state = ASSET_READY;
+		++batch_done;
+		return request->handle;
+	}
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		queued.push_back(request);
+	}
+	wake.notify_one();
+
+	return request->handle;
+}
+
+uint j1AssetLoader::PreloadMap(const char* file_name)
+{
+	AssetRequest* request = CreateRequest(ASSET_MAP, file_name);
+
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		queued.push_back(request);
+	}
+	wake.notify_one();
+
+	return request->handle;
+}
+
+ASSET_STATE j1AssetLoader::GetState(uint handle) const
+{
+	map<uint, AssetRequest*>::const_iterator request = requests.find(handle);
+	return (request != requests.end()) ? request->second->state : ASSET_FAILED;
+}
+
+bool j1AssetLoader::IsReady(uint handle) const
+{
+	ASSET_STATE state = GetState(handle);
+	return state == ASSET_READY || state == ASSET_FAILED;
+}
+
+SDL_Texture* j1AssetLoader::GetTexture(uint handle) const
+{
+	map<uint, AssetRequest*>::const_iterator request = requests.find(handle);
+	return (request != requests.end()) ? request->second->texture : NULL;
+}
+
+uint j1AssetLoader::GetFx(uint handle) const
+{
+	map<uint, AssetRequest*>::const_iterator request = requests.find(handle);
+	return (request != requests.end()) ? request->second->fx : 0;
+}
+
+void j1AssetLoader::Release(uint handle)
+{
+	map<uint, AssetRequest*>::iterator request = requests.find(handle);
+	if (request == requests.end())
+		return;
+
+	AssetRequest* asset = request->second;
+
+	//Still in a thread or waiting for the main one, Finish() deletes it
+	if (asset->state == ASSET_QUEUED || asset->state == ASSET_DECODED)
+	{
+		asset->released = true;
+		return;
+	}
+
+	if (asset->texture != NULL)
+		App->tex->UnLoad(asset->texture);
+
+	for (vector<SDL_Texture*>::iterator texture = asset->textures.begin(); texture != asset->textures.end(); ++texture)
+		App->tex->UnLoad(*texture);
+
+	Free(asset);
+	RELEASE(asset);
+	requests.erase(request);
+}
+
+float j1AssetLoader::GetProgress() const
+{
+	return (batch_total > 0) ? (float)batch_done / (float)batch_total : 1.0f;
+}
+
+bool j1AssetLoader::IsIdle() const
+{
+	return batch_done == batch_total;
+}
+
+AssetRequest* j1AssetLoader::CreateRequest(ASSET_TYPE type, const char* path)
+{
+	//A new batch starts when the last one is done
+	if (batch_done == batch_total)
+		batch_total = batch_done = 0;
+
+	AssetRequest* request = new AssetRequest();
+	request->handle = next_handle++;
+	request->type = type;
+	request->state = ASSET_QUEUED;
+	request->path = path;
+	request->released = false;
+	request->surface = NULL;
+	request->chunk = NULL;
+	request->document = NULL;
+	request->texture = NULL;
+	request->fx = 0;
+
+	requests.insert(pair<uint, AssetRequest*>(request->handle, request));
+	++batch_total;
+
+	return request;
+}
+
+void j1AssetLoader::Finish(AssetRequest* request)
+{
+	if (request->error.empty() == false)
+		LOG("Cannot load %s: %s", request->path.data(), request->error.data());
+
+	switch (request->type)
+	{
+	case ASSET_TEXTURE:
+		if (request->surface != NULL)
+			request->texture = App->tex->LoadSurface(request->surface, request->path.data());
+		break;
+
+	case ASSET_FX:
+		if (request->chunk != NULL)
+		{
+			//Someone loaded it meanwhile
+			request->fx = App->audio->GetFx(request->path.data());
+			if (request->fx != 0)
+				Mix_FreeChunk(request->chunk);
+			else
+				request->fx = App->audio->AddFx(request->chunk, request->path.data());
+
+			request->chunk = NULL;
+		}
+		break;
+
+	case ASSET_MAP:
+		for (vector<pair<string, SDL_Surface*>>::iterator image = request->images.begin(); image != request->images.end(); ++image)
+		{
+			SDL_Texture* texture = App->tex->LoadSurface(image->second, image->first.data());
+			if (texture != NULL)
+				request->textures.push_back(texture);
+		}
+
+		//j1Map owns it from now on
+		if (request->document != NULL)
+		{
+			App->map->Preload(request->path.data(), request->document);
+			request->document = NULL;
+		}
+		break;
+	}
+
+	bool ok = (request->type == ASSET_TEXTURE) ? request->texture != NULL : (request->type == ASSET_FX) ? request->fx != 0 : request->error.empty();
+	request->state = ok ? ASSET_READY : ASSET_FAILED;
+	++batch_done;
+
+	Free(request);
+
+	if (request->released)
+		Release(request->handle);
+}
+
+void j1AssetLoader::Free(AssetRequest* request)
+{
+	if (request->surface != NULL)
+	{
+		SDL_FreeSurface(request->surface);
+		request->surface = NULL;
+	}
+
+	if (request->chunk != NULL)
+	{
+		Mix_FreeChunk(request->chunk);
+		request->chunk = NULL;
+	}
+
+	RELEASE(request->document);
+
+	for (vector<pair<string, SDL_Surface*>>::iterator image = request->images.begin(); image != request->images.end(); ++image)
+		SDL_FreeSurface(image->second);
+	request->images.clear();
+}
+
+void j1AssetLoader::WorkerLoop()
+{
+	while (true)
+	{
+		AssetRequest* request = NULL;
+
+		{
+			unique_lock<mutex> lock(queue_mutex);
+			wake.wait(lock, [this]() { return running == false || queued.empty() == false; });
+
+			if (running == false)
+				break;
+
+			request = queued.front();
+			queued.pop_front();
+		}
+
+		Decode(request);
+
+		lock_guard<mutex> lock(queue_mutex);
+		decoded.push_back(request);
+	}
+}
+
+//Runs in the loading threads: only PhysFS, SDL_image, SDL_mixer and pugixml. Errors are kept for Finish(), LOG() isn't thread safe
+void j1AssetLoader::Decode(AssetRequest* request) const
+{
+	string path = (request->type == ASSET_MAP) ? App->map->GetPath(request->path.data()) : request->path;
+
+	if (App->fs->Exists(path.data()) == false)
+	{
+		request->error = "file not found";
+		return;
+	}
+
+	switch (request->type)
+	{
+	case ASSET_TEXTURE:
+	{
+		SDL_RWops* file = App->fs->Load(path.data(), &request->error);
+		if (file == NULL)
+			break;
+
+		request->surface = IMG_Load_RW(file, 1);
+		if (request->surface == NULL)
+			request->error = IMG_GetError();
+		break;
+	}
+
+	case ASSET_FX:
+	{
+		SDL_RWops* file = App->fs->Load(path.data(), &request->error);
+		if (file == NULL)
+			break;
+
+		request->chunk = Mix_LoadWAV_RW(file, 1);
+		if (request->chunk == NULL)
+			request->error = Mix_GetError();
+		break;
+	}
+
+	case ASSET_MAP:
+	{
+		FileSpan file;
+		if (App->fs->Map(path.data(), file, &request->error))
+			DecodeMap(request, file.data, file.size);
+
+		App->fs->Release(file);
+		break;
+	}
+	}
+}
+
+void j1AssetLoader::DecodeMap(AssetRequest* request, const char* buffer, uint size) const
+{
+	//Binary maps are already cheap to load, nothing to do in advance
+	if (size >= 4 && memcmp(buffer, BINARY_MAP_MAGIC, 4) == 0)
+		return;
+
+	pugi::xml_document* document = new pugi::xml_document();
+	pugi::xml_parse_result result = document->load_buffer(buffer, size);
+
+	if (result == NULL)
+	{
+		request->error = result.description();
+		RELEASE(document);
+		return;
+	}
+
+	request->document = document;
+
+	//The tileset images are the slow part
+	pugi::xml_node map_node = document->child("map");
+	for (pugi::xml_node tileset = map_node.child("tileset"); tileset; tileset = tileset.next_sibling("tileset"))
+	{
+		const char* source = tileset.child("image").attribute("source").as_string();
+		if (*source == '\0')
+			continue;
+
+		//A missing image isn't an error here, j1Map reports it when it loads the map
+		string image = App->map->GetImagePath(source);
+		string error;
+		SDL_RWops* file = App->fs->Load(image.data(), &error);
+		SDL_Surface* surface = (file != NULL) ? IMG_Load_RW(file, 1) : NULL;
+
+		if (surface != NULL)
+			request->images.push_back(pair<string, SDL_Surface*>(image, surface));
+	}
+}
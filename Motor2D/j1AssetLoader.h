@@ -0,0 +1,126 @@
+#ifndef __j1ASSETLOADER_H__
+#define __j1ASSETLOADER_H__
+
+#include "j1Module.h"
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+#define DEFAULT_LOADER_THREADS 2
+#define DEFAULT_UPLOAD_BUDGET 4000 //Microseconds per frame to turn decoded assets into textures, fx and maps
+
+struct SDL_Texture;
+struct SDL_Surface;
+struct Mix_Chunk;
+
+enum ASSET_TYPE
+{
+	ASSET_TEXTURE,
+	ASSET_FX,
+	ASSET_MAP
+};
+
+enum ASSET_STATE
+{
+	ASSET_QUEUED, //Waiting for or being decoded by a loading thread
+	ASSET_DECODED, //Waiting for the main thread
+	ASSET_READY,
+	ASSET_FAILED
+};
+
+struct AssetRequest
+{
+	uint			handle;
+	ASSET_TYPE		type;
+	ASSET_STATE		state;
+	string			path;
+	string			error; //Written by the loading thread, logged by the main one
+	bool			released; //Nobody wants it anymore, freed once it's finished
+
+	//Decoded by the loading threads
+	SDL_Surface*		surface;
+	Mix_Chunk*			chunk;
+	pugi::xml_document*	document;
+	vector<pair<string, SDL_Surface*>> images; //Tileset images of a map
+
+	//Created by the main thread
+	SDL_Texture*		texture;
+	uint				fx;
+	vector<SDL_Texture*> textures; //Tileset textures, one reference each until Release()
+};
+
+// Reads and decodes textures, fx and maps in background threads. Everything that touches the renderer, the audio
+// lists or the map list is done in PreUpdate, a few assets each frame.
+// Loaded textures keep one reference until the handle is released, the owner takes its own with the usual Load()
+class j1AssetLoader : public j1Module
+{
+public:
+
+	j1AssetLoader();
+
+	// Destructor
+	virtual ~j1AssetLoader();
+
+	// Called before render is available
+	bool Awake(pugi::xml_node&);
+
+	// Called before all Updates
+	bool PreUpdate();
+
+	// Called before quitting
+	bool CleanUp();
+
+	//Return a handle, 0 if the request can't be made
+	uint LoadTexture(const char* path);
+	uint LoadFx(const char* path);
+	uint PreloadMap(const char* file_name); //The next j1Map::Load() of the file skips the parsing
+
+	ASSET_STATE		GetState(uint handle) const;
+	bool			IsReady(uint handle) const; //Ready or failed, nothing left to do
+	SDL_Texture*	GetTexture(uint handle) const;
+	uint			GetFx(uint handle) const;
+	void			Release(uint handle);
+
+	float	GetProgress() const; //Of the requests made since the loader was last idle, from 0 to 1
+	bool	IsIdle() const;
+
+private:
+
+	AssetRequest*	CreateRequest(ASSET_TYPE type, const char* path);
+	void			Finish(AssetRequest* request);
+	void			Free(AssetRequest* request);
+
+	void	WorkerLoop();
+	void	Decode(AssetRequest* request) const;
+	void	DecodeMap(AssetRequest* request, const char* buffer, uint size) const;
+
+private:
+
+	map<uint, AssetRequest*> requests;
+	uint	next_handle;
+
+	uint	batch_total;
+	uint	batch_done;
+
+	vector<thread>	workers;
+	bool			running;
+
+	//Shared with the loading threads
+	mutex				queue_mutex;
+	condition_variable	wake;
+	deque<AssetRequest*> queued;
+	deque<AssetRequest*> decoded;
+
+	deque<AssetRequest*> finishing; //Main thread only
+
+	uint	num_threads;
+	double	upload_budget;
+};
+
+#endif // __j1ASSETLOADER_H__
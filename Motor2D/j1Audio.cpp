@@ -4,11 +4,21 @@
 #include "j1FileSystem.h"
 #include "j1Audio.h"
 #include "j1Render.h"
+#include "MusicStream.h"
 
 #include "SDL/include/SDL.h"
 #include "SDL_mixer\include\SDL_mixer.h"
 #pragma comment( lib, "SDL_mixer/libx86/SDL2_mixer.lib" )
 
+#include <chrono>
+
+#define MUSIC_THREAD_WAIT 10 //Milliseconds between refills of the music buffers
+
+static void MusicHook(void* udata, Uint8* stream, int len)
+{
+	((j1Audio*)udata)->MixMusic((short*)stream, len / sizeof(short));
+}
+
 j1Audio::j1Audio() : j1Module()
 {
 	music = NULL;
@@ -52,9 +62,58 @@ bool j1Audio::Awake(pugi::xml_node& config)
 		ret = true;
 	}
 
+	//Fixed pool of voices, extra sounds steal one or are dropped
+	pugi::xml_node voices_node = config.child("voices");
+	uint num_voices = voices_node.attribute("count").as_uint(DEFAULT_VOICES);
+	max_instances = voices_node.attribute("max_instances").as_uint(DEFAULT_FX_INSTANCES);
+	max_fx_plays = voices_node.attribute("max_fx_plays_per_frame").as_uint(DEFAULT_FX_PLAYS_PER_FRAME);
+	max_plays = voices_node.attribute("max_plays_per_frame").as_uint(DEFAULT_PLAYS_PER_FRAME);
+
+	if(active)
+		num_voices = Mix_AllocateChannels(num_voices);
+
+	Voice voice = { 0, FX_LOW, 0 };
+	voices.assign(num_voices, voice);
+
+	//The music is mixed by us, so two tracks can sound at once while they crossfade
+	if(active)
+	{
+		Mix_QuerySpec(&music_freq, &music_format, &music_channels);
+
+		if(music_format != AUDIO_S16SYS)
+		{
+			LOG("Music needs a 16 bit mixer, it won't play");
+		}
+		else
+		{
+			Mix_HookMusic(MusicHook, this);
+			music_running = true;
+			music_thread = thread(&j1Audio::MusicLoop, this);
+		}
+	}
+
 	return ret;
 }
 
+// Called before all Updates
+bool j1Audio::PreUpdate()
+{
+	plays = 0;
+
+	for(vector<FxData>::iterator i = fx.begin(); i != fx.end(); ++i)
+		i->plays = 0;
+
+	//The music thread can't LOG()
+	lock_guard<mutex> lock(music_mutex);
+	if(music_error.empty() == false)
+	{
+		LOG("%s", music_error.data());
+		music_error.clear();
+	}
+
+	return true;
+}
+
 // Called before quitting
 bool j1Audio::CleanUp()
 {
@@ -63,30 +122,35 @@ bool j1Audio::CleanUp()
 
 	LOG("Freeing sound FX, closing Mixer and Audio subsystem");
 
-	if(music != NULL)
+	if(music_thread.joinable())
 	{
-		Mix_FreeMusic(music);
+		{
+			lock_guard<mutex> lock(music_mutex);
+			music_running = false;
+		}
+		music_wake.notify_all();
+		music_thread.join();
 	}
 
-	list<Mix_Chunk*>::iterator i = fx.begin();
+	Mix_HookMusic(NULL, NULL);
+	RELEASE(music);
+	RELEASE(fading_music);
+	RELEASE(faded_music);
+	RELEASE(next_music);
+
+	Mix_HaltChannel(-1);
+
+	vector<FxData>::iterator i = fx.begin();
 
 	while (i != fx.end())
 	{
-		Mix_FreeChunk((*i));
+		Mix_FreeChunk(i->chunk);
 		++i;
 	}
 
 	fx.clear();
-
-	list<string>::iterator it = paths.begin();
-
-	while (it != paths.end())
-	{
-		it->empty();
-		it++;
-	}
-
-	paths.clear();
+	ids.clear();
+	voices.clear();
 
 	Mix_CloseAudio();
 	Mix_Quit();
@@ -98,55 +162,125 @@ bool j1Audio::CleanUp()
 // Play a music file
 bool j1Audio::PlayMusic(const char* path, float fade_time)
 {
-	bool ret = true;
-
-	if(!active)
+	if(!active || music_running == false)
 		return false;
 
-	if(music != NULL)
+	if(App->fs->Exists(path) == false)
 	{
-		if(fade_time > 0.0f)
-		{
-			Mix_FadeOutMusic(int(fade_time * 1000.0f));
-		}
-		else
-		{
-			Mix_HaltMusic();
-		}
+		LOG("Cannot load music %s, the file doesn't exist", path);
+		return false;
+	}
 
-		// this call blocks until fade out is done
-		Mix_FreeMusic(music);
+	//The last request wins if the thread didn't get to the previous one
+	{
+		lock_guard<mutex> lock(music_mutex);
+		music_request = path;
+		music_request_fade = fade_time;
 	}
+	music_wake.notify_one();
 
-	music = Mix_LoadMUS_RW(App->fs->Load(path), 1);
+	LOG("Queued music %s", path);
+	return true;
+}
+
+void j1Audio::MixMusic(short* stream, unsigned int samples)
+{
+	unsigned int frames = samples / music_channels;
+	float step = 1.0f / fade_frames;
+	float gain = (float)fade_position / fade_frames;
+
+	if(fading_music != NULL)
+		fading_music->Mix(stream, samples, 1.0f - gain, -step);
+
+	if(music != NULL)
+		music->Mix(stream, samples, gain, step);
+
+	fade_position = MIN(fade_position + frames, fade_frames);
 
-	if(music == NULL)
+	//The music thread frees it
+	if(fade_position == fade_frames && fading_music != NULL && faded_music == NULL)
 	{
-		LOG("Cannot load music %s. Mix_GetError(): %s\n", path, Mix_GetError());
-		ret = false;
+		faded_music = fading_music;
+		fading_music = NULL;
 	}
-	else
+}
+
+void j1Audio::MusicLoop()
+{
+	while(true)
 	{
-		if(fade_time > 0.0f)
+		string request;
+		float fade = 0.0f;
+
 		{
-			if(Mix_FadeInMusic(music, -1, (int) (fade_time * 1000.0f)) < 0)
-			{
-				LOG("Cannot fade in music %s. Mix_GetError(): %s", path, Mix_GetError());
-				ret = false;
-			}
+			unique_lock<mutex> lock(music_mutex);
+			music_wake.wait_for(lock, chrono::milliseconds(MUSIC_THREAD_WAIT), [this]() { return music_running == false || music_request.empty() == false; });
+
+			if(music_running == false)
+				break;
+
+			request.swap(music_request);
+			fade = music_request_fade;
 		}
-		else
+
+		if(request.empty() == false)
 		{
-			if(Mix_PlayMusic(music, -1) < 0)
+			RELEASE(next_music);
+			next_music = new MusicStream();
+
+			if(next_music->Open(request.data(), music_freq, music_format, music_channels))
 			{
-				LOG("Cannot play in music %s. Mix_GetError(): %s", path, Mix_GetError());
-				ret = false;
+				next_fade = fade;
 			}
+			else
+			{
+				lock_guard<mutex> lock(music_mutex);
+				music_error = "Cannot play music " + request + ": " + next_music->GetError();
+				RELEASE(next_music);
+			}
+		}
+
+		//Read ahead before it starts, so the crossfade doesn't wait for the disk
+		if(next_music != NULL)
+		{
+			next_music->Fill();
+			if(next_music->IsPrefetched())
+				StartCrossfade();
 		}
+
+		SDL_LockAudio();
+		MusicStream* playing = music;
+		MusicStream* fading = fading_music;
+		MusicStream* faded = faded_music;
+		faded_music = NULL;
+		SDL_UnlockAudio();
+
+		//Only this thread deletes them, so they are still alive
+		RELEASE(faded);
+
+		if(playing != NULL)
+			playing->Fill();
+		if(fading != NULL)
+			fading->Fill();
 	}
+}
 
-	LOG("Successfully playing %s", path);
-	return ret;
+void j1Audio::StartCrossfade()
+{
+	SDL_LockAudio();
+
+	//Still fading from an earlier change, cut it
+	MusicStream* cut = fading_music;
+
+	fading_music = music;
+	music = next_music;
+	fade_frames = MAX((unsigned int)(next_fade * music_freq), 1);
+	fade_position = 0;
+
+	SDL_UnlockAudio();
+
+	next_music = NULL;
+	RELEASE(cut);
 }
 
 // Load WAV
@@ -156,6 +290,10 @@ unsigned int j1Audio::LoadFx(const char* path)
 
 	if(!active)
 		return 0;
+
+	ret = GetFx(path);
+	if(ret != 0)
+		return ret;
 	
 	Mix_Chunk* chunk = Mix_LoadWAV_RW(App->fs->Load(path), 1);
 
@@ -165,33 +303,112 @@ unsigned int j1Audio::LoadFx(const char* path)
 	}
 	else
 	{
-		fx.push_back(chunk);
-		ret = fx.size();
-		string pth(path);
-		paths.push_back(pth);
+		ret = AddFx(chunk, path);
 	}
 
 	return ret;
 }
 
+unsigned int j1Audio::AddFx(Mix_Chunk* chunk, const char* path)
+{
+	FxData data;
+	data.chunk = chunk;
+	data.path = path;
+	data.plays = 0;
+	fx.push_back(data);
+
+	ids[data.path] = fx.size();
+
+	return fx.size();
+}
+
+unsigned int j1Audio::GetFx(const char* path) const
+{
+	map<string, unsigned int>::const_iterator id = ids.find(path);
+
+	return (id != ids.end()) ? id->second : 0;
+}
+
 // Play WAV
-bool j1Audio::PlayFx(unsigned int id, int repeat)
+bool j1Audio::PlayFx(unsigned int id, int repeat, FX_PRIORITY priority)
 {
-	bool ret = false;
+	if(!active || id == 0 || id > fx.size())
+		return false;
 
-	if(!active)
+	//Twenty units shooting in the same frame sound like two
+	FxData& data = fx[id - 1];
+	if(data.plays >= max_fx_plays || (plays >= max_plays && priority != FX_HIGH))
 		return false;
 
-	if(id > 0 && id <= fx.size())
+	int channel = FindVoice(id, priority);
+	if(channel < 0)
+		return false;
+
+	if(Mix_PlayChannel(channel, data.chunk, repeat) < 0)
 	{
-		list<Mix_Chunk*>::iterator i = fx.begin();
-		advance(i, id - 1);
-		Mix_PlayChannel(-1, (*i), repeat);
+		LOG("Cannot play fx %s. Mix_GetError(): %s", data.path.data(), Mix_GetError());
+		return false;
+	}
 
-		ret = true;
+	Voice& voice = voices[channel];
+	voice.fx = id;
+	voice.priority = priority;
+	voice.started = ++play_count;
+
+	++data.plays;
+	++plays;
+
+	return true;
+}
+
+//Channel to play the fx in: a free one, else the oldest copy of the same fx if it has too many,
+//else the least important and oldest sound if it isn't more important than this one. -1 if there's none
+int j1Audio::FindVoice(unsigned int id, FX_PRIORITY priority)
+{
+	int free_voice = -1;
+	int oldest_copy = -1;
+	int victim = -1;
+	uint instances = 0;
+
+	for(uint i = 0; i < voices.size(); ++i)
+	{
+		if(Mix_Playing(i) == 0)
+		{
+			if(free_voice < 0)
+				free_voice = i;
+			continue;
+		}
+
+		const Voice& voice = voices[i];
+
+		if(voice.fx == id)
+		{
+			++instances;
+			if(oldest_copy < 0 || voice.started < voices[oldest_copy].started)
+				oldest_copy = i;
+		}
+
+		if(voice.priority <= priority)
+		{
+			if(victim < 0 || voice.priority < voices[victim].priority || (voice.priority == voices[victim].priority && voice.started < voices[victim].started))
+				victim = i;
+		}
 	}
 
-	return ret;
+	//Enough copies of this one already, restart the oldest
+	if(oldest_copy >= 0 && instances >= max_instances)
+	{
+		Mix_HaltChannel(oldest_copy);
+		return oldest_copy;
+	}
+
+	if(free_voice >= 0)
+		return free_voice;
+
+	if(victim >= 0)
+		Mix_HaltChannel(victim);
+
+	return victim;
 }
 
 bool j1Audio::SetFxVolume(unsigned int _volume)
@@ -200,12 +417,12 @@ bool j1Audio::SetFxVolume(unsigned int _volume)
 	
 	if (_volume >= 0 && _volume <= MIX_MAX_VOLUME)
 	{
-		list<Mix_Chunk*>::iterator it = fx.begin();
+		vector<FxData>::iterator it = fx.begin();
 
 		for (it; it != fx.end(); it++)
 		{
 			
-			Mix_VolumeChunk((*it), _volume);
+			Mix_VolumeChunk(it->chunk, _volume);
 			ret = true;
 		}
 	}
@@ -221,20 +438,14 @@ bool j1Audio::SetFxVolume(unsigned int _volume, const char* fx_path)
 
 	if (_volume >= 0 && _volume <= MIX_MAX_VOLUME)
 	{
-		list<string>::iterator it = paths.begin();
+		unsigned int id = GetFx(fx_path);
 
-		for (it; it != paths.end(); it++)
+		if (id != 0)
 		{
-			for (list<Mix_Chunk*>::iterator i = fx.begin(); i != fx.end(); i++)
-			{
-				if ((*it) == fx_path)
-				{
-					Mix_VolumeChunk((*i), _volume);
-					return true;
-				}
-			}
+			Mix_VolumeChunk(fx[id - 1].chunk, _volume);
+			ret = true;
 		}
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
@@ -2,13 +2,44 @@
 #define __j1AUDIO_H__
 
 #include <list>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "j1Module.h"
 
 #define DEFAULT_MUSIC_FADE_TIME 2.0f
+#define DEFAULT_VOICES 16 //Mixer channels
+#define DEFAULT_FX_INSTANCES 3 //Copies of the same fx sounding at once
+#define DEFAULT_FX_PLAYS_PER_FRAME 2 //Of the same fx
+#define DEFAULT_PLAYS_PER_FRAME 6 //Of all of them
 
-struct _Mix_Music;
 struct Mix_Chunk;
+class MusicStream;
+
+//A voice can only be stolen by a sound of the same or higher priority
+enum FX_PRIORITY
+{
+	FX_LOW, //Shots and other repeated sounds
+	FX_NORMAL,
+	FX_HIGH //Answers to the player
+};
+
+struct FxData
+{
+	Mix_Chunk*		chunk;
+	string			path;
+	uint			plays; //This frame
+};
+
+struct Voice
+{
+	uint			fx; //0 if it was never used
+	FX_PRIORITY		priority;
+	uint			started; //Play order, the oldest is stolen first
+};
 
 class j1Audio : public j1Module
 {
@@ -22,28 +53,74 @@ public:
 	// Called before render is available
 	bool Awake(pugi::xml_node&);
 
+	// Called before all Updates
+	bool PreUpdate();
+
 	// Called before quitting
 	bool CleanUp();
 
-	// Play a music file
+	// Play a music file. It's opened and read ahead in the music thread, then crossfaded with the one playing
 	bool PlayMusic(const char* path, float fade_time = DEFAULT_MUSIC_FADE_TIME);
 
-	// Load a WAV in memory
+	// Load a WAV in memory. A path already loaded returns the same fx
 	unsigned int LoadFx(const char* path);
+	// Keep a chunk decoded elsewhere, returns its fx id
+	unsigned int AddFx(Mix_Chunk* chunk, const char* path);
+	// Id of a loaded fx, 0 if it isn't
+	unsigned int GetFx(const char* path) const;
 
-	// Play a previously loaded WAV
-	bool PlayFx(unsigned int fx, int repeat = 0);
+	// Play a previously loaded WAV. False if it was throttled or all the voices are busy with more important sounds
+	bool PlayFx(unsigned int fx, int repeat = 0, FX_PRIORITY priority = FX_NORMAL);
 
 	bool SetFxVolume(unsigned int _volume);
 
 	bool SetFxVolume(unsigned int _volume, const char* fx_path);
 
+	// Called by the mixer in the audio thread
+	void MixMusic(short* stream, unsigned int samples);
+
+private:
+
+	int FindVoice(unsigned int id, FX_PRIORITY priority);
+
+	void MusicLoop();
+	void StartCrossfade();
+
 private:
 
-	_Mix_Music*			music = NULL;
-	list<Mix_Chunk*>	fx;
-	list<string>	    paths;
+	//Music, mixed by MixMusic(). Swapped with the audio device locked
+	MusicStream*		music = NULL;
+	MusicStream*		fading_music = NULL; //Previous music while the crossfade lasts
+	MusicStream*		faded_music = NULL; //Done fading, the music thread deletes it
+	unsigned int		fade_frames = 1;
+	unsigned int		fade_position = 0;
+
+	//Music thread only
+	MusicStream*		next_music = NULL; //Being read ahead
+	float				next_fade = 0.0f;
+
+	thread				music_thread;
+	mutex				music_mutex;
+	condition_variable	music_wake;
+	bool				music_running = false;
+	string				music_request; //Shared with the music thread
+	float				music_request_fade = 0.0f;
+	string				music_error;
+
+	int					music_freq = 0;
+	unsigned short		music_format = 0;
+	int					music_channels = 0;
+
+	vector<FxData>		fx; //Index is the fx id - 1
+	map<string, unsigned int> ids; //Fx id of each path
+	vector<Voice>		voices; //One for each mixer channel
 	unsigned int		volume;
+
+	uint				plays = 0; //This frame
+	uint				play_count = 0;
+	uint				max_instances = DEFAULT_FX_INSTANCES;
+	uint				max_fx_plays = DEFAULT_FX_PLAYS_PER_FRAME;
+	uint				max_plays = DEFAULT_PLAYS_PER_FRAME;
 };
 
 #endif // __j1AUDIO_H__
\ No newline at end of file
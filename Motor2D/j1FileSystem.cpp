@@ -2,6 +2,7 @@
 #include "j1App.h"
 #include "p2Log.h"
 #include "j1FileSystem.h"
+#include "PackArchive.h"
 #include "PhysFS/include/physfs.h"
 #include "SDL/include/SDL.h"
 
@@ -24,6 +25,10 @@ j1FileSystem::j1FileSystem() : j1Module()
 // Destructor
 j1FileSystem::~j1FileSystem()
 {
+	for(vector<PackMount>::iterator mount = packs.begin(); mount != packs.end(); ++mount)
+		RELEASE(mount->pack);
+	packs.clear();
+
 	PHYSFS_deinit();
 }
 
@@ -49,6 +54,18 @@ bool j1FileSystem::Awake(pugi::xml_node& config)
 		// We add the writing directory as a reading directory too with speacial mount point
 		LOG("Writing directory is %s\n", write_path);
 		AddPath(write_path, GetSaveDirectory());
+
+		// Optionally pack the data of the other paths, then use the pack. It's saved in the write dir
+		pugi::xml_node build = config.child("build_pack");
+		if(build)
+		{
+			const char* pack_file = build.attribute("file").as_string();
+			if(BuildPack(pack_file, build.attribute("folder").as_string()))
+			{
+				string pack_path = string(PHYSFS_getWriteDir()) + PHYSFS_getDirSeparator() + pack_file;
+				AddPath(pack_path.data());
+			}
+		}
 	}
 
 	SDL_free(write_path);
@@ -60,6 +77,11 @@ bool j1FileSystem::Awake(pugi::xml_node& config)
 bool j1FileSystem::CleanUp()
 {
 	//LOG("Freeing File System subsystem");
+
+	for(map<string, pugi::xml_document*>::iterator document = xml_cache.begin(); document != xml_cache.end(); ++document)
+		RELEASE(document->second);
+	xml_cache.clear();
+
 	return true;
 }
 
@@ -68,6 +90,25 @@ bool j1FileSystem::AddPath(const char* path_or_zip, const char* mount_point)
 {
 	bool ret = false;
 
+	// Our own packs are mapped in memory, PhysFS doesn't read them
+	uint length = strlen(path_or_zip);
+	if(length > strlen(PACK_EXTENSION) && strcmp(path_or_zip + length - strlen(PACK_EXTENSION), PACK_EXTENSION) == 0)
+	{
+		PackMount mount;
+		mount.mount_point = (mount_point != NULL) ? mount_point : "";
+		mount.pack = new PackArchive();
+
+		if(mount.pack->Open(path_or_zip) == false)
+		{
+			LOG("File System error while adding pack %s", path_or_zip);
+			RELEASE(mount.pack);
+			return false;
+		}
+
+		packs.push_back(mount);
+		return true;
+	}
+
 	if(PHYSFS_mount(path_or_zip, mount_point, 1) == 0)
 		LOG("File System error while adding a path or zip(%s): %s\n", path_or_zip, PHYSFS_getLastError());
 	else
@@ -79,7 +120,8 @@ bool j1FileSystem::AddPath(const char* path_or_zip, const char* mount_point)
 // Check if a file exists
 bool j1FileSystem::Exists(const char* file) const
 {
-	return PHYSFS_exists(file) != 0;
+	const char* name = NULL;
+	return FindPack(file, name) != NULL || PHYSFS_exists(file) != 0;
 }
 
 // Check if a file is a directory
@@ -88,11 +130,33 @@ bool j1FileSystem::IsDirectory(const char* file) const
 	return PHYSFS_isDirectory(file) != 0;
 }
 
+// Without an error string it goes to the log. LOG() isn't thread safe
+static void ReportError(string* error, const char* action, const char* file, const char* reason)
+{
+	if(error != NULL)
+		*error = string(action) + " " + file + ": " + reason;
+	else
+		LOG("File System error while %s %s: %s\n", action, file, reason);
+}
+
 // Read a whole file and put it in a new buffer
-unsigned int j1FileSystem::Load(const char* file, char** buffer) const
+unsigned int j1FileSystem::Load(const char* file, char** buffer, string* error) const
 {
 	unsigned int ret = 0;
 
+	FileSpan span;
+	bool unpacked = false;
+	if(GetFromPack(file, span, unpacked, error))
+	{
+		if(unpacked == false)
+			return 0;
+
+		// The caller owns the buffer, so this one has to be a copy
+		*buffer = new char[MAX(span.size, 1)];
+		memcpy(*buffer, span.data, span.size);
+		return span.size;
+	}
+
 	PHYSFS_file* fs_file = PHYSFS_openRead(file);
 
 	if(fs_file != NULL)
@@ -105,28 +169,34 @@ unsigned int j1FileSystem::Load(const char* file, char** buffer) const
 			PHYSFS_sint64 readed = PHYSFS_read(fs_file, *buffer, 1, (PHYSFS_sint32)size);
 			if(readed != size)
 			{
-				LOG("File System error while reading from file %s: %s\n", file, PHYSFS_getLastError());
-				delete[] buffer;
-				buffer = NULL;
+				ReportError(error, "reading from file", file, PHYSFS_getLastError());
+				delete[] *buffer;
+				*buffer = NULL;
 			}
 			else
 				ret = (uint)readed;
 		}
 
 		if(PHYSFS_close(fs_file) == 0)
-			LOG("File System error while closing file %s: %s\n", file, PHYSFS_getLastError());
+			ReportError(error, "closing file", file, PHYSFS_getLastError());
 	}
 	else
-		LOG("File System error while opening file %s: %s\n", file, PHYSFS_getLastError());
+		ReportError(error, "opening file", file, PHYSFS_getLastError());
 
 	return ret;
 }
 
 // Read a whole file and put it in a new buffer
-SDL_RWops* j1FileSystem::Load(const char* file) const
+SDL_RWops* j1FileSystem::Load(const char* file, string* error) const
 {
+	// Straight from the pack memory
+	FileSpan span;
+	bool unpacked = false;
+	if(GetFromPack(file, span, unpacked, error))
+		return unpacked ? SDL_RWFromConstMem(span.data, span.size) : NULL;
+
 	char* buffer;
-	int size = Load(file, &buffer);
+	int size = Load(file, &buffer, error);
 
 	if(size > 0)
 	{
@@ -148,6 +218,289 @@ int close_sdl_rwops(SDL_RWops *rw)
 	return 0;
 }
 
+// SDL_RWops over an open PhysFS file --------------------------------------------------
+static Sint64 SDLCALL physfs_rwops_size(SDL_RWops* rw)
+{
+	return PHYSFS_fileLength((PHYSFS_File*)rw->hidden.unknown.data1);
+}
+
+static Sint64 SDLCALL physfs_rwops_seek(SDL_RWops* rw, Sint64 offset, int whence)
+{
+	PHYSFS_File* file = (PHYSFS_File*)rw->hidden.unknown.data1;
+	Sint64 position = offset;
+
+	if(whence == RW_SEEK_CUR)
+		position += PHYSFS_tell(file);
+	else if(whence == RW_SEEK_END)
+		position += PHYSFS_fileLength(file);
+
+	if(position < 0 || PHYSFS_seek(file, (PHYSFS_uint64)position) == 0)
+		return -1;
+
+	return position;
+}
+
+static size_t SDLCALL physfs_rwops_read(SDL_RWops* rw, void* ptr, size_t size, size_t maxnum)
+{
+	PHYSFS_sint64 read = PHYSFS_read((PHYSFS_File*)rw->hidden.unknown.data1, ptr, (PHYSFS_uint32)size, (PHYSFS_uint32)maxnum);
+	return (read > 0) ? (size_t)read : 0;
+}
+
+static size_t SDLCALL physfs_rwops_write(SDL_RWops* rw, const void* ptr, size_t size, size_t num)
+{
+	return 0;
+}
+
+static int SDLCALL physfs_rwops_close(SDL_RWops* rw)
+{
+	int ret = (PHYSFS_close((PHYSFS_File*)rw->hidden.unknown.data1) != 0) ? 0 : -1;
+	SDL_FreeRW(rw);
+	return ret;
+}
+
+SDL_RWops* j1FileSystem::OpenRead(const char* file) const
+{
+	string error;
+	FileSpan span;
+	bool unpacked = false;
+
+	if(GetFromPack(file, span, unpacked, &error))
+		return unpacked ? SDL_RWFromConstMem(span.data, span.size) : NULL;
+
+	PHYSFS_File* fs_file = PHYSFS_openRead(file);
+
+	if(fs_file == NULL)
+		return NULL;
+
+	SDL_RWops* rw = SDL_AllocRW();
+	if(rw == NULL)
+	{
+		PHYSFS_close(fs_file);
+		return NULL;
+	}
+
+	rw->size = physfs_rwops_size;
+	rw->seek = physfs_rwops_seek;
+	rw->read = physfs_rwops_read;
+	rw->write = physfs_rwops_write;
+	rw->close = physfs_rwops_close;
+	rw->type = SDL_RWOPS_UNKNOWN;
+	rw->hidden.unknown.data1 = fs_file;
+
+	return rw;
+}
+
+bool j1FileSystem::Map(const char* file, FileSpan& span, string* error) const
+{
+	bool unpacked = false;
+	if(GetFromPack(file, span, unpacked, error))
+		return unpacked;
+
+	// Anywhere else it has to be read
+	char* buffer = NULL;
+	span.size = Load(file, &buffer, error);
+	span.data = buffer;
+	span.owned = buffer;
+
+	return span.size > 0;
+}
+
+void j1FileSystem::Release(FileSpan& span) const
+{
+	RELEASE_ARRAY(span.owned);
+	span.data = NULL;
+	span.size = 0;
+}
+
+bool j1FileSystem::LoadXML(const char* file, pugi::xml_document& document) const
+{
+	// pugixml frees the buffer with its own deallocator, so it must come from its allocator
+	pugi::allocation_function allocate = pugi::get_memory_allocation_function();
+	char* buffer = NULL;
+	unsigned int size = 0;
+
+	FileSpan span;
+	bool unpacked = false;
+
+	if(GetFromPack(file, span, unpacked, NULL))
+	{
+		if(unpacked)
+		{
+			// The pack memory is read only, the parser writes in the buffer
+			size = span.size;
+			buffer = (char*)allocate(MAX(size, 1));
+			memcpy(buffer, span.data, size);
+		}
+	}
+	else
+	{
+		PHYSFS_file* fs_file = PHYSFS_openRead(file);
+
+		if(fs_file != NULL)
+		{
+			size = (unsigned int)MAX(PHYSFS_fileLength(fs_file), 0);
+			buffer = (char*)allocate(MAX(size, 1));
+
+			if(PHYSFS_read(fs_file, buffer, 1, size) != (PHYSFS_sint64)size)
+			{
+				LOG("File System error while reading from file %s: %s\n", file, PHYSFS_getLastError());
+				pugi::get_memory_deallocation_function()(buffer);
+				buffer = NULL;
+			}
+
+			PHYSFS_close(fs_file);
+		}
+		else
+			LOG("File System error while opening file %s: %s\n", file, PHYSFS_getLastError());
+	}
+
+	if(buffer == NULL)
+		return false;
+
+	pugi::xml_parse_result result = document.load_buffer_inplace_own(buffer, size);
+
+	if(result == NULL)
+	{
+		LOG("Could not load xml file %s. PUGI error: %s", file, result.description());
+		return false;
+	}
+
+	return true;
+}
+
+const pugi::xml_document* j1FileSystem::GetXML(const char* file)
+{
+	map<string, pugi::xml_document*>::iterator cached = xml_cache.find(file);
+	if(cached != xml_cache.end())
+		return cached->second;
+
+	pugi::xml_document* document = new pugi::xml_document();
+
+	if(LoadXML(file, *document) == false)
+	{
+		RELEASE(document);
+		return NULL;
+	}
+
+	xml_cache.insert(pair<string, pugi::xml_document*>(file, document));
+	return document;
+}
+
+void j1FileSystem::UnloadXML(const char* file)
+{
+	map<string, pugi::xml_document*>::iterator cached = xml_cache.find(file);
+	if(cached != xml_cache.end())
+	{
+		RELEASE(cached->second);
+		xml_cache.erase(cached);
+	}
+}
+
+PackArchive* j1FileSystem::FindPack(const char* file, const char*& name) const
+{
+	for(vector<PackMount>::const_iterator mount = packs.begin(); mount != packs.end(); ++mount)
+	{
+		const string& prefix = mount->mount_point;
+		if(prefix.empty() == false && strncmp(file, prefix.data(), prefix.size()) != 0)
+			continue;
+
+		name = file + prefix.size();
+		if(mount->pack->Exists(name))
+			return mount->pack;
+	}
+
+	return NULL;
+}
+
+bool j1FileSystem::GetFromPack(const char* file, FileSpan& span, bool& unpacked, string* error) const
+{
+	const char* name = NULL;
+	PackArchive* pack = FindPack(file, name);
+
+	if(pack == NULL)
+		return false;
+
+	unpacked = pack->Get(name, span);
+	if(unpacked == false)
+	{
+		span = FileSpan();
+		ReportError(error, "unpacking file", file, "corrupt file in pack");
+	}
+
+	return true;
+}
+
+void j1FileSystem::CollectFiles(const char* folder, vector<string>& files) const
+{
+	char** list = PHYSFS_enumerateFiles(folder);
+
+	for(char** item = list; *item != NULL; ++item)
+	{
+		string path = (*folder != '\0') ? string(folder) + "/" + *item : string(*item);
+
+		// The write directory is mounted there, it would add everything twice
+		if(path + "/" == GetSaveDirectory())
+			continue;
+
+		if(PHYSFS_isDirectory(path.data()))
+			CollectFiles(path.data(), files);
+		else
+			files.push_back(path);
+	}
+
+	PHYSFS_freeList(list);
+}
+
+bool j1FileSystem::BuildPack(const char* pack_file, const char* folder) const
+{
+	vector<string> paths;
+	CollectFiles(folder, paths);
+
+	vector<PackFile> files;
+	files.reserve(paths.size());
+
+	for(vector<string>::iterator path = paths.begin(); path != paths.end(); ++path)
+	{
+		// Older packs and the pack being built are left out
+		if(path->size() > strlen(PACK_EXTENSION) && path->compare(path->size() - strlen(PACK_EXTENSION), string::npos, PACK_EXTENSION) == 0)
+			continue;
+
+		string error;
+		char* buffer = NULL;
+		uint size = Load(path->data(), &buffer, &error);
+
+		// Empty files are packed, the ones that can't be read are left out
+		if(error.empty() == false)
+		{
+			LOG("Not packing %s: %s", path->data(), error.data());
+			RELEASE_ARRAY(buffer);
+			continue;
+		}
+
+		PackFile file;
+		file.name = *path;
+		file.data.assign(buffer, buffer + size);
+		files.push_back(file);
+
+		RELEASE_ARRAY(buffer);
+	}
+
+	// A pack without files has no name table and wouldn't open
+	if(files.empty())
+	{
+		LOG("No files to pack in %s", pack_file);
+		return false;
+	}
+
+	vector<uchar> pack;
+	PackArchive::Build(files, pack);
+
+	bool ret = Save(pack_file, (const char*)&pack[0], pack.size()) == pack.size();
+	LOG("Packed %d files in %s (%d bytes)", files.size(), pack_file, pack.size());
+
+	return ret;
+}
+
 // Save a whole buffer to disk
 unsigned int j1FileSystem::Save(const char* file, const char* buffer, unsigned int size) const
 {
@@ -2,8 +2,20 @@
 #define __j1FILESYSTEM_H__
 
 #include "j1Module.h"
+#include <vector>
+#include <map>
 
 struct SDL_RWops;
+struct FileSpan;
+class PackArchive;
+
+#define PACK_EXTENSION ".pack"
+
+struct PackMount
+{
+	string			mount_point; //Prefix of its files, empty for the root
+	PackArchive*	pack;
+};
 
 int close_sdl_rwops(SDL_RWops *rw);
 
@@ -22,7 +34,7 @@ public:
 	// Called before quitting
 	bool CleanUp();
 
-	// Utility functions
+	// Utility functions. Packs are searched before the rest of paths
 	bool AddPath(const char* path_or_zip, const char* mount_point = NULL);
 	bool Exists(const char* file) const;
 	bool IsDirectory(const char* file) const;
@@ -31,14 +43,39 @@ public:
 		return "save/";
 	}
 
-	// Open for Read/Write
-	unsigned int Load(const char* file, char** buffer) const;
-	SDL_RWops* Load(const char* file) const;
+	// Open for Read/Write. With an error string the failures are written there instead of LOG(), so they can be called from any thread
+	unsigned int Load(const char* file, char** buffer, string* error = NULL) const;
+	SDL_RWops* Load(const char* file, string* error = NULL) const;
+	// Reads from the file as it's used instead of loading it whole. No LOG(), it can be called from any thread
+	SDL_RWops* OpenRead(const char* file) const;
+
+	// Read only view of the file, without copies if it's in a pack. Give it back with Release()
+	bool Map(const char* file, FileSpan& span, string* error = NULL) const;
+	void Release(FileSpan& span) const;
 
 	unsigned int Save(const char* file, const char* buffer, unsigned int size) const;
 
+	// Parse xml in place, in a buffer the document owns, without the copy load_buffer() makes
+	bool LoadXML(const char* file, pugi::xml_document& document) const;
+	// Same, for data read by several modules or scenes: parsed once and kept until UnloadXML() or CleanUp()
+	const pugi::xml_document* GetXML(const char* file);
+	void UnloadXML(const char* file);
+
+	// Write every file under folder to a pack in the write directory
+	bool BuildPack(const char* pack_file, const char* folder = "") const;
+
 private:
 
+	PackArchive* FindPack(const char* file, const char*& name) const;
+	// The file from a mounted pack. True if a mounted pack has it, unpacked tells if it could be read from there. A pack failure isn't retried with PhysFS
+	bool GetFromPack(const char* file, FileSpan& span, bool& unpacked, string* error) const;
+	void CollectFiles(const char* folder, vector<string>& files) const;
+
+private:
+
+	vector<PackMount> packs;
+	map<string, pugi::xml_document*> xml_cache;
+
 };
 
 #endif // __j1FILESYSTEM_H__
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "j1Input.h"
 #include "j1Window.h"
 #include "j1Render.h"
+#include "j1Map.h"
 #include "InputManager.h"
 
 #define MAX_KEYS 300
@@ -149,6 +150,11 @@ bool j1Input::PreUpdate()
 			}
 			break;
 
+		case SDL_RENDER_TARGETS_RESET:
+			//The device was lost, the map chunks are render targets
+			App->map->RestoreChunks();
+			break;
+
 		case SDL_KEYDOWN:
 
 			if (is_writting)
@@ -5,6 +5,8 @@
 #include "j1FileSystem.h"
 #include "j1Textures.h"
 #include "j1Map.h"
+#include "DataCodec.h"
+#include "PackArchive.h"
 #include <math.h>
 
 j1Map::j1Map() : j1Module(), map_loaded(false)
@@ -24,10 +26,74 @@ bool j1Map::Awake(pugi::xml_node& config)
 
 	folder.append(config.child("folder").child_value());
 
+	//Maps to convert to the binary format on Start(), they are saved in the write dir
+	for(pugi::xml_node build = config.child("build_binary"); build; build = build.next_sibling("build_binary"))
+		binary_builds.push_back(pair<string, string>(build.attribute("file").as_string(), build.attribute("output").as_string()));
+
 	return ret;
 }
 
+// Called before the first frame, the tilesets need the renderer
+bool j1Map::Start()
+{
+	for(list<pair<string, string>>::iterator build = binary_builds.begin(); build != binary_builds.end(); ++build)
+	{
+		uint id = 0;
+		if(Load(build->first.data(), id))
+		{
+			SaveBinary(id, build->second.data());
+			UnLoad(id);
+		}
+	}
+	binary_builds.clear();
+
+	return true;
+}
+
 void j1Map::Draw(int id)
+{
+	map<uint, MapData*>::iterator map_it = maps.find(id);
+	if (map_it == maps.end())
+		return;
+
+	MapData* data = map_it->second;
+
+	//Static layers are baked in chunks on the first draw, so maps never drawn (debug ones) don't take texture memory
+	if (data->baked == false)
+	{
+		data->baked = true;
+		if (BakeChunks(data, id) == false)
+			LOG("Map %d will be drawn tile by tile", id);
+	}
+
+	if (data->chunks.empty())
+	{
+		DrawTiles(id);
+		return;
+	}
+
+	//Only the chunks inside the camera
+	SDL_Rect cam = App->render->camera;
+
+	int x1 = MAX(-cam.x / MAP_CHUNK_SIZE, 0);
+	int y1 = MAX(-cam.y / MAP_CHUNK_SIZE, 0);
+	int x2 = MIN((-cam.x + cam.w) / MAP_CHUNK_SIZE, data->chunks_x - 1);
+	int y2 = MIN((-cam.y + cam.h) / MAP_CHUNK_SIZE, data->chunks_y - 1);
+
+	for (int y = y1; y <= y2; ++y)
+	{
+		for (int x = x1; x <= x2; ++x)
+		{
+			SDL_Texture* chunk = data->chunks[y * data->chunks_x + x];
+			SDL_Rect r = { 0, 0, MAP_CHUNK_SIZE, MAP_CHUNK_SIZE };
+			SDL_QueryTexture(chunk, NULL, NULL, &r.w, &r.h);
+
+			App->render->Blit(chunk, x * MAP_CHUNK_SIZE, y * MAP_CHUNK_SIZE, &r);
+		}
+	}
+}
+
+void j1Map::DrawTiles(int id)
 {
 	map<uint, MapData*>::iterator map_it = maps.find(id);
 	if (map_it == maps.end())
@@ -56,17 +122,12 @@ void j1Map::Draw(int id)
 		{
 			for (int x = begin.x; x <= end.x; ++x)
 			{
-				int tile_id = layer->Get(x, y);
-				if (tile_id > 0)
+				const TileInfo* tile = map_it->second->GetTile(layer->Get(x, y));
+				if (tile != NULL)
 				{
-					TileSet* tileset = GetTilesetFromTileId(tile_id, id);
-
-					SDL_Rect r = tileset->GetTileRect(tile_id);
 					iPoint pos = MapToWorld(x, y, id);
 
-					SDL_Rect cam = App->render->camera;
-
-					App->render->Blit(tileset->texture, pos.x, pos.y, &r);
+					App->render->Blit(tile->tileset->texture, pos.x, pos.y, &tile->rect);
 				}
 			}
 		}
@@ -75,6 +136,145 @@ void j1Map::Draw(int id)
 
 }
 
+void j1Map::BuildTileTable(MapData* data, uint map_id)
+{
+	//Up to the end of the last tileset. Bigger gids in the layers have no tile, GetTile() returns NULL for them
+	uint max_gid = 0;
+
+	for (list<TileSet*>::iterator set = data->tilesets.begin(); set != data->tilesets.end(); ++set)
+		max_gid = MAX(max_gid, (uint)((*set)->firstgid + (*set)->num_tiles_width * (*set)->num_tiles_height - 1));
+
+	data->tiles.resize(max_gid + 1);
+	data->tiles[0].tileset = NULL;
+
+	if (data->tilesets.empty())
+	{
+		data->tiles.resize(1);
+		return;
+	}
+
+	for (uint gid = 1; gid <= max_gid; ++gid)
+	{
+		TileInfo& tile = data->tiles[gid];
+		tile.tileset = GetTilesetFromTileId(gid, map_id);
+		tile.rect = tile.tileset->GetTileRect(gid);
+	}
+}
+
+bool j1Map::BakeChunks(MapData* data, uint map_id)
+{
+	//Isometric tiles overlap their neighbours, those maps are drawn tile by tile
+	if (data->type != MAPTYPE_ORTHOGONAL || SDL_RenderTargetSupported(App->render->renderer) == SDL_FALSE)
+		return false;
+
+	SDL_Renderer* renderer = App->render->renderer;
+
+	//Tiles bigger than the map tile overflow into the next chunks
+	int max_w = data->tile_width;
+	int max_h = data->tile_height;
+	for (list<TileSet*>::iterator set = data->tilesets.begin(); set != data->tilesets.end(); ++set)
+	{
+		max_w = MAX(max_w, (*set)->tile_width);
+		max_h = MAX(max_h, (*set)->tile_height);
+	}
+
+	int width = data->width * data->tile_width;
+	int height = data->height * data->tile_height;
+	data->chunks_x = (width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE;
+	data->chunks_y = (height + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE;
+
+	for (int cy = 0; cy < data->chunks_y; ++cy)
+	{
+		for (int cx = 0; cx < data->chunks_x; ++cx)
+		{
+			SDL_Rect area = { cx * MAP_CHUNK_SIZE, cy * MAP_CHUNK_SIZE, MIN(MAP_CHUNK_SIZE, width - cx * MAP_CHUNK_SIZE), MIN(MAP_CHUNK_SIZE, height - cy * MAP_CHUNK_SIZE) };
+
+			SDL_Texture* chunk = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, area.w, area.h);
+			if (chunk == NULL)
+			{
+				LOG("Could not create map chunk. SDL_CreateTexture error: %s", SDL_GetError());
+				SDL_SetRenderTarget(renderer, NULL);
+				SetTilesetsBlendMode(data, SDL_BLENDMODE_BLEND);
+				DestroyChunks(data);
+				return false;
+			}
+
+			data->chunks.push_back(chunk);
+			SDL_SetTextureBlendMode(chunk, SDL_BLENDMODE_BLEND);
+			SDL_SetRenderTarget(renderer, chunk);
+			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+			SDL_RenderClear(renderer);
+
+			//Tiles touching the chunk, in the same order Draw used
+			int x1 = MAX((area.x - max_w + 1) / data->tile_width, 0);
+			int y1 = MAX((area.y - max_h + 1) / data->tile_height, 0);
+			int x2 = MIN((area.x + area.w - 1) / data->tile_width, data->width - 1);
+			int y2 = MIN((area.y + area.h - 1) / data->tile_height, data->height - 1);
+
+			for (list<MapLayer*>::iterator layer = data->layers.begin(); layer != data->layers.end(); ++layer)
+			{
+				//The first layer replaces the transparent clear. Blended there, its translucent pixels would be blended twice and come out darker
+				SetTilesetsBlendMode(data, (layer == data->layers.begin()) ? SDL_BLENDMODE_NONE : SDL_BLENDMODE_BLEND);
+
+				for (int y = y1; y <= y2 && y < (*layer)->height; ++y)
+				{
+					for (int x = x1; x <= x2 && x < (*layer)->width; ++x)
+					{
+						const TileInfo* tile = data->GetTile((*layer)->Get(x, y));
+						if (tile != NULL)
+						{
+							iPoint pos = MapToWorld(x, y, map_id);
+							SDL_Rect dst = { pos.x - area.x, pos.y - area.y, tile->rect.w, tile->rect.h };
+
+							SDL_RenderCopy(renderer, tile->tileset->texture, &tile->rect, &dst);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	SDL_SetRenderTarget(renderer, NULL);
+	SetTilesetsBlendMode(data, SDL_BLENDMODE_BLEND);
+
+	LOG("Map baked in %d chunks", data->chunks.size());
+	return true;
+}
+
+void j1Map::SetTilesetsBlendMode(MapData* data, SDL_BlendMode mode)
+{
+	for (list<TileSet*>::iterator set = data->tilesets.begin(); set != data->tilesets.end(); ++set)
+	{
+		if ((*set)->texture != NULL)
+			SDL_SetTextureBlendMode((*set)->texture, mode);
+	}
+}
+
+void j1Map::RestoreChunks()
+{
+	for (map<uint, MapData*>::iterator map_it = maps.begin(); map_it != maps.end(); ++map_it)
+	{
+		//Not baked yet or drawn tile by tile
+		if (map_it->second->chunks.empty())
+			continue;
+
+		DestroyChunks(map_it->second);
+
+		if (BakeChunks(map_it->second, map_it->first) == false)
+			LOG("Could not bake the map again after the render targets reset, it will be drawn tile by tile");
+	}
+}
+
+void j1Map::DestroyChunks(MapData* data)
+{
+	for (uint i = 0; i < data->chunks.size(); ++i)
+		SDL_DestroyTexture(data->chunks[i]);
+
+	data->chunks.clear();
+	data->chunks_x = 0;
+	data->chunks_y = 0;
+}
+
 int Properties::Get(const char* value, int default_value) const
 {
 	list<Property*>::const_iterator i = list_p.begin();
@@ -225,6 +425,8 @@ bool j1Map::CleanUp()
 
 		map_it->second->layers.clear();
 
+		DestroyChunks(map_it->second);
+
 		//delete MapData
 		delete map_it->second;
 
@@ -236,6 +438,14 @@ bool j1Map::CleanUp()
 	// Clean up the pugui tree
 	map_file.reset();
 
+	map<string, pugi::xml_document*>::iterator preload = preloaded.begin();
+	while(preload != preloaded.end())
+	{
+		RELEASE(preload->second);
+		++preload;
+	}
+	preloaded.clear();
+
 	return true;
 }
 
@@ -267,6 +477,8 @@ void j1Map::UnLoad(const uint& id)
 
 		map_it->second->layers.clear();
 
+		DestroyChunks(map_it->second);
+
 		//delete MapData
 		delete map_it->second;
 
@@ -279,34 +491,63 @@ void j1Map::UnLoad(const uint& id)
 // Load new map
 bool j1Map::Load(const char* file_name, uint &id)
 {
-	bool ret = true;
-	string tmp = folder.data();
-	tmp = tmp + file_name;
+	//Parsed in the background, no need to read it again
+	map<string, pugi::xml_document*>::iterator preload = preloaded.find(file_name);
+	if(preload != preloaded.end())
+	{
+		pugi::xml_document* document = preload->second;
+		preloaded.erase(preload);
+
+		bool ret = LoadDocument(file_name, *document, id);
+		RELEASE(document);
+		return ret;
+	}
+
+	string tmp = GetPath(file_name);
+
+	FileSpan file;
+	App->fs->Map(tmp.data(), file);
+
+	bool ret = LoadBuffer(file_name, file.data, file.size, id);
+	App->fs->Release(file);
+
+	return ret;
+}
 
-	char* buf;
-	int size = App->fs->Load(tmp.data(), &buf);
-	pugi::xml_parse_result result = map_file.load_buffer(buf, size);
+bool j1Map::LoadBuffer(const char* file_name, const char* buffer, uint size, uint& id)
+{
+	if(size >= 4 && memcmp(buffer, BINARY_MAP_MAGIC, 4) == 0)
+	{
+		// Compact binary map, no XML involved ----------------------------------------------
+		MapData* map_data = new MapData();
+		bool ret = LoadBinary(buffer, size, map_data);
+
+		return AddMap(file_name, map_data, ret, id);
+	}
 
-	delete[] buf;
-	buf = NULL;
+	pugi::xml_parse_result result = map_file.load_buffer(buffer, size);
 
 	if(result == NULL)
 	{
 		LOG("Could not load map xml file %s. pugi error: %s", file_name, result.description());
-		ret = false;
+		map_loaded = false;
+		return false;
 	}
 
+	return LoadDocument(file_name, map_file, id);
+}
+
+bool j1Map::LoadDocument(const char* file_name, const pugi::xml_document& document, uint& id)
+{
 	MapData* map_data = new MapData();
+	pugi::xml_node map_node = document.child("map");
 
 	// Load general info ----------------------------------------------
-	if(ret == true)
-	{
-		ret = LoadMap(map_data);
-	}
+	bool ret = LoadMap(map_node, map_data);
 
 	// Load all tilesets info ----------------------------------------------
 	pugi::xml_node tileset;
-	for(tileset = map_file.child("map").child("tileset"); tileset && ret; tileset = tileset.next_sibling("tileset"))
+	for(tileset = map_node.child("tileset"); tileset && ret; tileset = tileset.next_sibling("tileset"))
 	{
 		TileSet* set = new TileSet();
 
@@ -325,7 +566,7 @@ bool j1Map::Load(const char* file_name, uint &id)
 
 	// Load layer info ----------------------------------------------
 	pugi::xml_node layer;
-	for(layer = map_file.child("map").child("layer"); layer && ret; layer = layer.next_sibling("layer"))
+	for(layer = map_node.child("layer"); layer && ret; layer = layer.next_sibling("layer"))
 	{
 		MapLayer* lay = new MapLayer();
 
@@ -335,12 +576,39 @@ bool j1Map::Load(const char* file_name, uint &id)
 			map_data->layers.push_back(lay);
 	}
 
+	return AddMap(file_name, map_data, ret, id);
+}
+
+void j1Map::Preload(const char* file_name, pugi::xml_document* document)
+{
+	map<string, pugi::xml_document*>::iterator preload = preloaded.find(file_name);
+	if(preload != preloaded.end())
+		RELEASE(preload->second);
+
+	preloaded[file_name] = document;
+}
+
+string j1Map::GetPath(const char* file_name) const
+{
+	return folder + file_name;
+}
+
+string j1Map::GetImagePath(const char* image) const
+{
+	//Same than PATH(), but safe to call from the loading threads
+	return folder + "/" + image;
+}
+
+bool j1Map::AddMap(const char* file_name, MapData* map_data, bool ret, uint& id)
+{
 	if(ret == true)
 	{
 		id = maps.size() + 1;
 		maps.insert(pair<uint,MapData*>(id, map_data));
 
-		LOG("Successfully parsed map XML file: %s", file_name);
+		BuildTileTable(map_data, id);
+
+		LOG("Successfully parsed map file: %s", file_name);
 		LOG("width: %d height: %d", map_data->width, map_data->height);
 		LOG("tile_width: %d tile_height: %d", map_data->tile_width, map_data->tile_height);
 
@@ -375,10 +643,9 @@ bool j1Map::Load(const char* file_name, uint &id)
 }
 
 // Load map general properties
-bool j1Map::LoadMap(MapData* data)
+bool j1Map::LoadMap(pugi::xml_node& map, MapData* data)
 {
 	bool ret = true;
-	pugi::xml_node map = map_file.child("map");
 
 	if(map == NULL)
 	{
@@ -476,7 +743,8 @@ bool j1Map::LoadTilesetImage(pugi::xml_node& tileset_node, TileSet* set)
 	}
 	else
 	{
-		set->texture = App->tex->Load(PATH(folder.data(), image.attribute("source").as_string()));
+		set->image = image.attribute("source").as_string();
+		set->texture = App->tex->Load(GetImagePath(set->image.data()).data());
 		int w, h;
 		SDL_QueryTexture(set->texture, NULL, NULL, &w, &h);
 		set->tex_width = image.attribute("width").as_int();
@@ -520,18 +788,309 @@ bool j1Map::LoadLayer(pugi::xml_node& node, MapLayer* layer)
 	else
 	{
 		layer->data = new uint[layer->width*layer->height];
-		memset(layer->data, 0, layer->width*layer->height);
+		memset(layer->data, 0, layer->width*layer->height*sizeof(uint));
 
-		int i = 0;
-		for(pugi::xml_node tile = layer_data.child("tile"); tile; tile = tile.next_sibling("tile"))
+		string encoding(layer_data.attribute("encoding").as_string());
+
+		if(encoding == "csv")
+		{
+			ret = LoadLayerCSV(layer_data.child_value(), layer);
+		}
+		else if(encoding == "base64")
 		{
-			layer->data[i++] = tile.attribute("gid").as_int(0);
+			ret = LoadLayerBase64(layer_data.child_value(), layer_data.attribute("compression").as_string(), layer);
+		}
+		else
+		{
+			int i = 0;
+			for(pugi::xml_node tile = layer_data.child("tile"); tile && i < layer->width*layer->height; tile = tile.next_sibling("tile"))
+			{
+				layer->data[i++] = tile.attribute("gid").as_int(0);
+			}
+		}
+
+		if(ret == false)
+		{
+			LOG("Error parsing map xml file: Wrong data in layer %s.", layer->name.data());
+			delete layer;
+			layer = NULL;
 		}
 	}
 
 	return ret;
 }
 
+bool j1Map::LoadLayerCSV(const char* text, MapLayer* layer)
+{
+	int size = layer->width*layer->height;
+	int i = 0;
+
+	char* next = NULL;
+	for(const char* c = text; *c != '\0' && i < size; c = next)
+	{
+		layer->data[i++] = strtoul(c, &next, 10);
+
+		if(next == c)
+			return false;
+
+		//Skip the comma and the new lines
+		while(*next == ',' || *next == ' ' || *next == '\n' || *next == '\r' || *next == '\t')
+			++next;
+	}
+
+	return i == size;
+}
+
+bool j1Map::LoadLayerBase64(const char* text, const string& compression, MapLayer* layer)
+{
+	vector<uchar> bytes;
+	if(Base64Decode(text, bytes) == false)
+		return false;
+
+	//Little endian gids, read straight into the layer
+	uint size = layer->width*layer->height*sizeof(uint);
+
+	if(compression == "zlib" || compression == "gzip")
+	{
+		return Inflate(bytes.data(), bytes.size(), (uchar*)layer->data, size) == (int)size;
+	}
+	else if(compression.empty())
+	{
+		if(bytes.size() != size)
+			return false;
+
+		memcpy(layer->data, bytes.data(), size);
+		return true;
+	}
+
+	LOG("Unsupported layer compression %s", compression.data());
+	return false;
+}
+
+// Compact binary maps ---------------------------------------------------------------
+// Little endian. Header: magic, version, width, height, tile width, tile height, type, background rgba, tilesets, layers
+// Tileset: firstgid, margin, spacing, tile width, tile height, offset x, offset y, texture width, texture height, name, image
+// Layer: width, height, name, properties (count, then name and value), width * height gids
+// Strings are a length followed by the characters
+
+struct BinaryReader
+{
+	BinaryReader(const char* buffer, uint size) : cursor(buffer), end(buffer + size), error(false)
+	{}
+
+	int Int()
+	{
+		int value = 0;
+		Bytes(&value, sizeof(int));
+		return value;
+	}
+
+	string String()
+	{
+		int length = Int();
+		if(error || length < 0 || length > end - cursor)
+		{
+			error = true;
+			return string();
+		}
+
+		string value(cursor, length);
+		cursor += length;
+		return value;
+	}
+
+	void Bytes(void* output, uint size)
+	{
+		if(error || size > (uint)(end - cursor))
+		{
+			error = true;
+			return;
+		}
+
+		memcpy(output, cursor, size);
+		cursor += size;
+	}
+
+	const char* cursor;
+	const char* end;
+	bool error;
+};
+
+struct BinaryWriter
+{
+	void Int(int value)
+	{
+		Bytes(&value, sizeof(int));
+	}
+
+	void String(const string& value)
+	{
+		Int(value.size());
+		Bytes(value.data(), value.size());
+	}
+
+	void Bytes(const void* input, uint size)
+	{
+		buffer.insert(buffer.end(), (const char*)input, (const char*)input + size);
+	}
+
+	vector<char> buffer;
+};
+
+bool j1Map::LoadBinary(const char* buffer, uint size, MapData* data)
+{
+	BinaryReader reader(buffer + 4, size - 4);
+
+	int version = reader.Int();
+	if(version != BINARY_MAP_VERSION)
+	{
+		LOG("Error loading binary map: version %d, expected %d", version, BINARY_MAP_VERSION);
+		return false;
+	}
+
+	data->width = reader.Int();
+	data->height = reader.Int();
+	data->tile_width = reader.Int();
+	data->tile_height = reader.Int();
+	data->type = (MapTypes)reader.Int();
+	reader.Bytes(&data->background_color, sizeof(SDL_Color));
+
+	int num_tilesets = reader.Int();
+	int num_layers = reader.Int();
+
+	for(int i = 0; i < num_tilesets && reader.error == false; ++i)
+	{
+		TileSet* set = new TileSet();
+		set->firstgid = reader.Int();
+		set->margin = reader.Int();
+		set->spacing = reader.Int();
+		set->tile_width = reader.Int();
+		set->tile_height = reader.Int();
+		set->offset_x = reader.Int();
+		set->offset_y = reader.Int();
+		set->tex_width = reader.Int();
+		set->tex_height = reader.Int();
+		set->name = reader.String();
+		set->image = reader.String();
+
+		set->texture = App->tex->Load(GetImagePath(set->image.data()).data());
+		set->num_tiles_width = (set->tile_width > 0) ? set->tex_width / set->tile_width : 0;
+		set->num_tiles_height = (set->tile_height > 0) ? set->tex_height / set->tile_height : 0;
+
+		data->tilesets.push_back(set);
+
+		//Its gids size the tile table
+		if(set->firstgid < 1 || set->num_tiles_width < 0 || set->num_tiles_height < 0 || (uint64)set->firstgid + (uint64)set->num_tiles_width * set->num_tiles_height > TILE_GID_MASK)
+		{
+			LOG("Error loading binary map: tileset %s has wrong gids", set->name.data());
+			return false;
+		}
+	}
+
+	for(int i = 0; i < num_layers && reader.error == false; ++i)
+	{
+		MapLayer* layer = new MapLayer();
+		layer->width = reader.Int();
+		layer->height = reader.Int();
+		layer->name = reader.String();
+
+		//CreateWalkabilityMap() and the drawing index every layer with the map size
+		if(reader.error == false && (layer->width != data->width || layer->height != data->height))
+		{
+			LOG("Error loading binary map: layer %s is %dx%d in a %dx%d map", layer->name.data(), layer->width, layer->height, data->width, data->height);
+			RELEASE(layer);
+			return false;
+		}
+
+		int num_properties = reader.Int();
+		for(int p = 0; p < num_properties && reader.error == false; ++p)
+		{
+			Properties::Property* property = new Properties::Property();
+			property->name = reader.String();
+			property->value = reader.Int();
+			layer->properties.list_p.push_back(property);
+		}
+
+		//Raw gids, copied as they are
+		if(reader.error == false && layer->width > 0 && layer->height > 0)
+		{
+			layer->data = new uint[layer->width*layer->height];
+			reader.Bytes(layer->data, layer->width*layer->height*sizeof(uint));
+		}
+
+		data->layers.push_back(layer);
+	}
+
+	if(reader.error)
+	{
+		LOG("Error loading binary map: the file is truncated");
+		return false;
+	}
+
+	return true;
+}
+
+bool j1Map::SaveBinary(uint map_id, const char* file_name) const
+{
+	map<uint, MapData*>::const_iterator map_it = maps.find(map_id);
+	if(map_it == maps.end())
+		return false;
+
+	const MapData* data = map_it->second;
+	BinaryWriter writer;
+
+	writer.Bytes(BINARY_MAP_MAGIC, 4);
+	writer.Int(BINARY_MAP_VERSION);
+	writer.Int(data->width);
+	writer.Int(data->height);
+	writer.Int(data->tile_width);
+	writer.Int(data->tile_height);
+	writer.Int(data->type);
+	writer.Bytes(&data->background_color, sizeof(SDL_Color));
+	writer.Int(data->tilesets.size());
+	writer.Int(data->layers.size());
+
+	for(list<TileSet*>::const_iterator set = data->tilesets.begin(); set != data->tilesets.end(); ++set)
+	{
+		writer.Int((*set)->firstgid);
+		writer.Int((*set)->margin);
+		writer.Int((*set)->spacing);
+		writer.Int((*set)->tile_width);
+		writer.Int((*set)->tile_height);
+		writer.Int((*set)->offset_x);
+		writer.Int((*set)->offset_y);
+		writer.Int((*set)->tex_width);
+		writer.Int((*set)->tex_height);
+		writer.String((*set)->name);
+		writer.String((*set)->image);
+	}
+
+	for(list<MapLayer*>::const_iterator layer = data->layers.begin(); layer != data->layers.end(); ++layer)
+	{
+		writer.Int((*layer)->width);
+		writer.Int((*layer)->height);
+		writer.String((*layer)->name);
+
+		writer.Int((*layer)->properties.list_p.size());
+		for(list<Properties::Property*>::const_iterator p = (*layer)->properties.list_p.begin(); p != (*layer)->properties.list_p.end(); ++p)
+		{
+			writer.String((*p)->name);
+			writer.Int((*p)->value);
+		}
+
+		writer.Bytes((*layer)->data, (*layer)->width*(*layer)->height*sizeof(uint));
+	}
+
+	if(App->fs->Save(file_name, writer.buffer.data(), writer.buffer.size()) != writer.buffer.size())
+	{
+		LOG("Could not save binary map %s", file_name);
+		return false;
+	}
+
+	LOG("Saved binary map %s (%d bytes)", file_name, writer.buffer.size());
+	return true;
+}
+
 // Load a group of properties from a node and fill a list with it
 bool j1Map::LoadProperties(pugi::xml_node& node, Properties& properties)
 {
@@ -583,12 +1142,12 @@ bool j1Map::CreateWalkabilityMap(int& width, int& height, uchar** buffer, uint m
 			{
 				int i = (y*layer->width) + x;
 
-				int tile_id = layer->Get(x, y);
-				TileSet* tileset = (tile_id > 0) ? GetTilesetFromTileId(tile_id, map_id) : NULL;
+				int tile_id = layer->Get(x, y) & TILE_GID_MASK;
+				const TileInfo* tile = map_it->second->GetTile(tile_id);
 
-				if (tileset != NULL)
+				if (tile != NULL)
 				{
-					map[i] = (tile_id - tileset->firstgid) > 0 ? 1 : 0;
+					map[i] = (tile_id - tile->tileset->firstgid) > 0 ? 1 : 0;
 					/*TileType* ts = tileset->GetTileType(tile_id);
 					if(ts != NULL)
 					{
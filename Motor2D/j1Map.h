@@ -3,9 +3,15 @@
 
 #include <list>
 #include <map>
+#include <vector>
 #include "PugiXml/src/pugixml.hpp"
 #include "j1Module.h"
 
+#define MAP_CHUNK_SIZE 512 //Pixels per side of the baked map chunks
+#define BINARY_MAP_MAGIC "BMAP" //First bytes of the compact binary maps
+#define BINARY_MAP_VERSION 1
+#define TILE_GID_MASK 0x1FFFFFFF //The 3 high bits of a layer gid are the flip flags
+
 // ----------------------------------------------------
 struct Properties
 {
@@ -63,6 +69,7 @@ struct TileSet
 	SDL_Rect GetTileRect(int id) const;
 
 	string				name;
+	string				image; //Relative to the maps folder
 	int					firstgid;
 	int					margin;
 	int					spacing;
@@ -77,6 +84,13 @@ struct TileSet
 	int					offset_y;
 };
 
+// ----------------------------------------------------
+struct TileInfo
+{
+	TileSet*	tileset;
+	SDL_Rect	rect;
+};
+
 enum MapTypes
 {
 	MAPTYPE_UNKNOWN = 0,
@@ -95,6 +109,21 @@ struct MapData
 	MapTypes			type;
 	list<TileSet*>		tilesets;
 	list<MapLayer*>		layers;
+
+	//Tileset and source rect of every gid used, built at load
+	vector<TileInfo>	tiles;
+
+	inline const TileInfo* GetTile(uint gid) const
+	{
+		gid &= TILE_GID_MASK;
+		return (gid > 0 && gid < tiles.size()) ? &tiles[gid] : NULL;
+	}
+
+	//All layers baked in textures of MAP_CHUNK_SIZE, empty if the map is drawn tile by tile
+	vector<SDL_Texture*> chunks;
+	int					chunks_x = 0;
+	int					chunks_y = 0;
+	bool				baked = false; //Bake already tried, chunks stay empty if it failed
 };
 
 // ----------------------------------------------------
@@ -110,30 +139,59 @@ public:
 	// Called before render is available
 	bool Awake(pugi::xml_node& conf);
 
+	// Called before the first frame
+	bool Start();
+
 	// Called each loop iteration
 	void Draw(int id);
+	// The renderer lost the content of its targets, the chunks are baked again
+	void RestoreChunks();
 
 	// Called before quitting
 	bool CleanUp();
 
 	// Load new map and get the id of the map
 	bool Load(const char* path,uint &id);
+	// Same, from the file already read (tmx or binary) or parsed
+	bool LoadBuffer(const char* file_name, const char* buffer, uint size, uint& id);
+	bool LoadDocument(const char* file_name, const pugi::xml_document& document, uint& id);
+
+	// Keep a document parsed in the background, the next Load() of file_name uses it. Takes the ownership
+	void Preload(const char* file_name, pugi::xml_document* document);
+	string GetPath(const char* file_name) const;
+	string GetImagePath(const char* image) const; //Path of a tileset image, the one given to j1Textures
 	void UnLoad(const uint& id);
 
+	//Write a loaded map in the compact binary format to the write directory. Load() reads it like a .tmx
+	//Maps are converted offline with <build_binary file="x.tmx" output="x.bmap"/> in the map config
+	bool SaveBinary(uint map_id, const char* file_name) const;
+
 	iPoint MapToWorld(int x, int y, uint map_id);
 	iPoint WorldToMap(int x, int y, uint map_id);
 	bool CreateWalkabilityMap(int& width, int& height, uchar** buffer,uint map_id) const;
 
 private:
 
-	bool LoadMap(MapData* data);
+	bool LoadMap(pugi::xml_node& map, MapData* data);
+	bool AddMap(const char* file_name, MapData* map_data, bool ret, uint& id);
 	bool LoadTilesetDetails(pugi::xml_node& tileset_node, TileSet* set);
 	bool LoadTilesetImage(pugi::xml_node& tileset_node, TileSet* set);
 	bool LoadLayer(pugi::xml_node& node, MapLayer* layer);
+	bool LoadLayerCSV(const char* text, MapLayer* layer);
+	bool LoadLayerBase64(const char* text, const string& compression, MapLayer* layer);
+	bool LoadBinary(const char* buffer, uint size, MapData* data);
 	bool LoadProperties(pugi::xml_node& node, Properties& properties);
 
 	TileSet* GetTilesetFromTileId(int id, uint map_id)const;
 
+	void BuildTileTable(MapData* data, uint map_id);
+
+	//Render every layer in chunk textures. Returns false if the renderer can't render to textures
+	bool BakeChunks(MapData* data, uint map_id);
+	void DestroyChunks(MapData* data);
+	void SetTilesetsBlendMode(MapData* data, SDL_BlendMode mode);
+	void DrawTiles(int id); //Draw without chunks, tile by tile
+
 public:
 
 	map<uint, MapData*> maps;
@@ -141,8 +199,10 @@ public:
 private:
 
 	pugi::xml_document	map_file;
+	map<string, pugi::xml_document*> preloaded;
 	string				folder;
 	bool				map_loaded;
+	list<pair<string, string>> binary_builds; //tmx file and binary output, from <build_binary> in the config
 };
 
 #endif // __j1MAP_H__
\ No newline at end of file
@@ -5,29 +5,43 @@
 #include "j1Map.h"
 #include "EntityManager.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 
 j1PathFinding::j1PathFinding() :
 j1Module(),
-map(NULL),
 width(0),
 height(0)
 {
 	name.append("pathfinding");
+
+	deadlines[PATH_PLAYER] = DEFAULT_PLAYER_DEADLINE;
+	deadlines[PATH_CHASE] = DEFAULT_CHASE_DEADLINE;
+	deadlines[PATH_PATROL] = DEFAULT_PATROL_DEADLINE;
 }
 
 // Destructor
 j1PathFinding::~j1PathFinding()
 {
-	delete[] map;
-	map = NULL;
+	solvers.Stop();
 }
 
 // Called before render is available
-bool j1PathFinding::Awake(pugi::xml_node&)
+bool j1PathFinding::Awake(pugi::xml_node& config)
 {
 	LOG("Init Pathfinding library");
 	bool ret = true;
 
+	num_threads = config.child("solver").attribute("threads").as_uint(DEFAULT_PATH_THREADS);
+
+	pugi::xml_node scheduler = config.child("scheduler");
+	budget = scheduler.attribute("budget_us").as_double(DEFAULT_PATH_BUDGET);
+	deadlines[PATH_PLAYER] = scheduler.attribute("player_deadline").as_uint(DEFAULT_PLAYER_DEADLINE);
+	deadlines[PATH_CHASE] = scheduler.attribute("chase_deadline").as_uint(DEFAULT_CHASE_DEADLINE);
+	deadlines[PATH_PATROL] = scheduler.attribute("patrol_deadline").as_uint(DEFAULT_PATROL_DEADLINE);
+
 	return ret;
 }
 
@@ -37,53 +51,90 @@ bool j1PathFinding::Start()
 	LOG("Start pathfinding");
 	bool ret = true;
 
+	clock.Start();
+
+	if (num_threads > 0)
+	{
+		LOG("Starting %d pathfinding threads", num_threads);
+		solvers.Start(num_threads);
+	}
+
 	return ret;
 }
 
-bool j1PathFinding::PreUpdate()
+// Order of the paths solved in the main thread: overdue paths first, then by priority. Ties go to the earliest deadline
+struct PathSchedule
 {
-	//timer.Start();
+	PathSchedule(uint now) : now(now)
+	{}
+
+	bool operator()(const Path* a, const Path* b) const
+	{
+		bool a_overdue = a->deadline <= now;
+		bool b_overdue = b->deadline <= now;
+
+		if (a_overdue != b_overdue)
+			return a_overdue;
+		if (a_overdue == false && a->priority != b->priority)
+			return a->priority < b->priority;
+		return a->deadline < b->deadline;
+	}
 
-	int paths_calculated = 0;
-	int paths_deleted = 0;
-	int paths_to_process = paths_to_calculate.size();
+	uint now;
+};
+
+bool j1PathFinding::PreUpdate()
+{
+	schedule.clear();
 
-	int iterations = 0;
-	bool can_calculate = true;
 	std::map<uint, Path*>::iterator path = paths_to_calculate.begin();
 
 	while (path != paths_to_calculate.end())
 	{
 		if (path->second->completed == false)
 		{
-			if (can_calculate)
-			{
-				iterations = CalculatePath(path->second, 8 - iterations);
+			//Threaded paths are solved in the background
+			if (path->second->threaded == false)
+				schedule.push_back(path->second);
+		}
+		else if (path->second->collect == false)
+		{
+			//Keep it one more frame so the units can read the result
+			path->second->collect = true;
 
-				++paths_calculated;
+			if (path->second->not_found && path->second->cancelled == false)
+				LOG("PathFinding: no path found from (%d,%d) to (%d,%d)", path->second->origin.x, path->second->origin.y, path->second->destination.x, path->second->destination.y);
 
-				if (iterations >= 8)
-					can_calculate = false;
-			}
- 			
+			if (path->second->from_cache == false && path->second->cancelled == false)
+				StoreCachedPath(path->second);
 		}
 		else
 		{
 			delete path->second;
 			path->second = NULL;
-			std::map<uint, Path*>::iterator tmp = path;
-			++path;
-			paths_to_calculate.erase(tmp);
-
-			++paths_deleted;
+			path = paths_to_calculate.erase(path);
+			continue;
 		}
 		++path;
 	}
 
-	/*if (paths_to_process > 0)
-		LOG("Pathfinding time %d, Iterations %i,  Paths to process: %i, Paths calculated %i, Paths deleted %i", 
-			timer.Read(), iterations, paths_to_process, paths_calculated, paths_deleted);*/
+	if (schedule.empty())
+		return true;
+
+	sort(schedule.begin(), schedule.end(), PathSchedule(clock.Read()));
 
+	j1PerfTimer timer;
+
+	vector<Path*>::iterator next = schedule.begin();
+	while (next != schedule.end())
+	{
+		double remaining = budget - timer.ReadMs() * 1000.0;
+		if (remaining <= 0)
+			break;
+
+		CalculatePath(*next, remaining);
+		++next;
+	}
 
 	return true;
 }
@@ -98,11 +149,16 @@ bool j1PathFinding::PostUpdate()
 bool j1PathFinding::CleanUp()
 {
 	LOG("Freeing pathfinding library");
+	LOG("Path cache: %d hits, %d misses", cache_hits, cache_misses);
+
+	//Threads must stop before deleting the paths they could be solving
+	solvers.Stop();
 
 	std::map<uint, Path*>::iterator path = paths_to_calculate.begin();
 
 	while (path != paths_to_calculate.end())
 	{
+		ReleaseGrid(path->second->grid);
 		delete path->second;
 		path->second = NULL;
 		std::map<uint, Path*>::iterator tmp = path;
@@ -112,8 +168,19 @@ bool j1PathFinding::CleanUp()
 
 	paths_to_calculate.clear();
 
-	delete[] map;
-	map = NULL;
+	list<PathGrid*>::iterator grid = free_grids.begin();
+	while (grid != free_grids.end())
+	{
+		delete *grid;
+		++grid;
+	}
+	free_grids.clear();
+
+	ClearFlowFields();
+	ClearPathCache();
+
+	walk_map.reset();
+	hierarchy.reset();
 	return true;
 }
 
@@ -123,16 +190,128 @@ void j1PathFinding::SetMap(uint width, uint height, uchar* data)
 	this->width = width;
 	this->height = height;
 
-	delete[] map;
-	map = NULL;
-	map = new uchar[width*height];
-	memcpy(map, data, width*height);
+	//Paths still being solved keep a reference to the old map
+	walk_map = make_shared<const WalkabilityMap>(width, height, data);
+
+	ClearFlowFields();
+
+	//Cached paths belong to the old map
+	++map_version;
+	ClearPathCache();
+
+	j1Timer build_time;
+	hierarchy = make_shared<const PathHierarchy>(walk_map);
+	LOG("Path hierarchy: %d clusters, %d nodes built in %d ms", hierarchy->GetNumClusters(), hierarchy->GetNumNodes(), build_time.Read());
+
+	//Grids of the old map have a different size
+	list<PathGrid*>::iterator grid = free_grids.begin();
+	while (grid != free_grids.end())
+	{
+		delete *grid;
+		++grid;
+	}
+	free_grids.clear();
+}
+
+const FlowField* j1PathFinding::GetFlowField(const iPoint& destination)
+{
+	if (IsWalkable(destination) == false)
+		return NULL;
+
+	list<FlowField*>::iterator field = flow_fields.begin();
+	while (field != flow_fields.end())
+	{
+		if ((*field)->GetDestination() == destination)
+		{
+			//Move it to the front
+			flow_fields.splice(flow_fields.begin(), flow_fields, field);
+			return flow_fields.front();
+		}
+		++field;
+	}
+
+	flow_fields.push_front(new FlowField(*walk_map, destination));
+
+	if (flow_fields.size() > FLOW_FIELD_CACHE)
+	{
+		delete flow_fields.back();
+		flow_fields.pop_back();
+	}
+
+	return flow_fields.front();
+}
+
+void j1PathFinding::ClearFlowFields()
+{
+	list<FlowField*>::iterator field = flow_fields.begin();
+	while (field != flow_fields.end())
+	{
+		delete *field;
+		++field;
+	}
+	flow_fields.clear();
+}
+
+uint j1PathFinding::GetCacheHits()const
+{
+	return cache_hits;
+}
+
+uint j1PathFinding::GetCacheMisses()const
+{
+	return cache_misses;
+}
+
+bool j1PathFinding::FindCachedPath(const PathCacheKey& key, CachedPath& result)
+{
+	std::map<PathCacheKey, list<CachedPath>::iterator>::iterator entry = path_cache_index.find(key);
+
+	if (entry == path_cache_index.end())
+	{
+		++cache_misses;
+		return false;
+	}
+
+	++cache_hits;
+
+	//Move it to the front
+	path_cache.splice(path_cache.begin(), path_cache, entry->second);
+	result = *entry->second;
+
+	return true;
+}
+
+void j1PathFinding::StoreCachedPath(const Path* path)
+{
+	//Solved with a map that is no longer loaded
+	if (path->map_version != map_version)
+		return;
+
+	PathCacheKey key(path->origin, path->destination, path->map_version);
+
+	if (path_cache_index.find(key) != path_cache_index.end())
+		return;
+
+	path_cache.push_front(CachedPath(key, path->path_finished, path->partial));
+	path_cache_index[key] = path_cache.begin();
+
+	if (path_cache.size() > PATH_CACHE_SIZE)
+	{
+		path_cache_index.erase(path_cache.back().key);
+		path_cache.pop_back();
+	}
+}
+
+void j1PathFinding::ClearPathCache()
+{
+	path_cache.clear();
+	path_cache_index.clear();
 }
 
 bool j1PathFinding::CheckBoundaries(const iPoint& pos) const
 {
-	return (pos.x >= 0 && pos.x <= width &&
-		pos.y >= 0 && pos.y <= height);
+	return (pos.x >= 0 && pos.x < (int)width &&
+		pos.y >= 0 && pos.y < (int)height);
 }
 
 bool j1PathFinding::IsWalkable(const iPoint& pos) const
@@ -142,51 +321,350 @@ bool j1PathFinding::IsWalkable(const iPoint& pos) const
 }
 
 uchar j1PathFinding::GetTileAt(const iPoint& pos) const
+{
+	if (walk_map)
+		return walk_map->GetTileAt(pos);
+
+	return INVALID_WALK_CODE;
+}
+
+const WalkabilityMap* j1PathFinding::GetWalkabilityMap() const
+{
+	return walk_map.get();
+}
+
+// WalkabilityMap ------------------------------------------------------------------
+WalkabilityMap::WalkabilityMap(uint width, uint height, const uchar* data) : width(width), height(height), data(data, data + width * height)
+{
+	BuildJumpTables();
+	BuildBitsets();
+}
+
+bool WalkabilityMap::CheckBoundaries(const iPoint& pos) const
+{
+	return (pos.x >= 0 && pos.x < (int)width &&
+		pos.y >= 0 && pos.y < (int)height);
+}
+
+bool WalkabilityMap::IsWalkable(const iPoint& pos) const
+{
+	uchar t = GetTileAt(pos);
+	return t != INVALID_WALK_CODE && t > 0;
+}
+
+uchar WalkabilityMap::GetTileAt(const iPoint& pos) const
 {
 	if (CheckBoundaries(pos))
-		return map[(pos.y*width) + pos.x];
+		return data[(pos.y*width) + pos.x];
 
 	return INVALID_WALK_CODE;
 }
 
+int WalkabilityMap::GetJumpDistance(const iPoint& pos, uint dir) const
+{
+	if (CheckBoundaries(pos) == false)
+		return -1;
+
+	return jump_distances[(pos.y * width + pos.x) * 8 + dir];
+}
+
+void WalkabilityMap::BuildBitsets()
+{
+	row_words = (width + 63) / 64;
+	column_words = (height + 63) / 64;
+	row_bits.assign(row_words * height, 0);
+	column_bits.assign(column_words * width, 0);
+
+	for (uint y = 0; y < height; ++y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			if (IsWalkable(iPoint(x, y)))
+			{
+				row_bits[y * row_words + x / 64] |= (uint64)1 << (x % 64);
+				column_bits[x * column_words + y / 64] |= (uint64)1 << (y % 64);
+			}
+		}
+	}
+}
+
+// Index of the lowest bit set. word can't be 0
+static int LowestBit(uint64 word)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)word))
+		return index;
+	_BitScanForward(&index, (unsigned long)(word >> 32));
+	return index + 32;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+// Tiles outside the map are not walkable, like in GetTileAt
+static bool IsSpanWalkable(const vector<uint64>& bits, uint words, int length, int lines, int line, int from, int to, int& blocked)
+{
+	if (line < 0 || line >= lines || from < 0 || from >= length)
+	{
+		blocked = from;
+		return false;
+	}
+
+	int last = MIN(to, length - 1);
+	const uint64* line_bits = &bits[line * words];
+
+	for (int word = from / 64; word <= last / 64; ++word)
+	{
+		uint64 mask = ~(uint64)0;
+		if (word == from / 64)
+			mask &= ~(uint64)0 << (from % 64);
+		if (word == last / 64)
+			mask &= ~(uint64)0 >> (63 - last % 64);
+
+		uint64 holes = ~line_bits[word] & mask;
+		if (holes != 0)
+		{
+			blocked = word * 64 + LowestBit(holes);
+			return false;
+		}
+	}
+
+	if (to > last)
+	{
+		blocked = length;
+		return false;
+	}
+
+	return true;
+}
+
+bool WalkabilityMap::IsRowWalkable(int y, int from, int to, int& blocked) const
+{
+	return IsSpanWalkable(row_bits, row_words, width, height, y, from, to, blocked);
+}
 
+bool WalkabilityMap::IsColumnWalkable(int x, int from, int to, int& blocked) const
+{
+	return IsSpanWalkable(column_bits, column_words, height, width, x, from, to, blocked);
+}
 
-// PathList ------------------------------------------------------------------------
-list<PathNode>::iterator PathList::Find(const iPoint& point) 
+bool WalkabilityMap::IsLineWalkable(const iPoint& origin, const iPoint& destination, iPoint& hitted) const
 {
-	list<PathNode>::iterator i = list_nodes.begin();
+	iPoint p1 = origin;
+	iPoint p2 = destination;
+
+	bool steep = (abs(p2.y - p1.y) > abs(p2.x - p1.x));
+
+	if (steep)
+	{
+		swap(p1.x, p1.y);
+		swap(p2.x, p2.y);
+	}
+
+	if (p1.x > p2.x)
+	{
+		swap(p1.x, p2.x);
+		swap(p1.y, p2.y);
+	}
+
+	int dx = p2.x - p1.x;
+	int dy = abs(p2.y - p1.y);
 
-	while (i != list_nodes.end())
+	int error = dx / 2;
+	int ystep = (p1.y < p2.y) ? 1 : -1;
+	int y = p1.y;
+	int x = p1.x;
+
+	while (x < p2.x)
 	{
-		if (i->pos == point)
+		//Tiles the line walks before y changes: a row span (a column one if steep)
+		int run = (dy == 0) ? p2.x - x : error / dy + 1;
+		run = MIN(run, p2.x - x);
+
+		int blocked;
+		bool walkable = steep ? IsColumnWalkable(y, x, x + run - 1, blocked) : IsRowWalkable(y, x, x + run - 1, blocked);
+
+		if (walkable == false)
 		{
-			return i;
+			hitted = steep ? iPoint(y, blocked) : iPoint(blocked, y);
+			return false;
+		}
+
+		x += run;
+		error -= run * dy;
+		if (error < 0)
+		{
+			y += ystep;
+			error += dx;
 		}
-		++i;
 	}
 
-	return list_nodes.end();
+	return true;
 }
 
-list<PathNode>::iterator PathList::GetNodeLowestScore() 
+void WalkabilityMap::SetJumpDistance(int x, int y, uint dir, int distance)
 {
-	list<PathNode>::iterator ret = list_nodes.end();
-	int min = 6500535;
-	list<PathNode>::iterator i = list_nodes.begin();
+	jump_distances[(y * width + x) * 8 + dir] = distance;
+}
 
-	while (i != list_nodes.end())
+// Same forced neighbour rules the recursive jump used
+bool WalkabilityMap::IsForced(int cx, int cy, int dx, int dy) const
+{
+	if (dx != 0)
 	{
-		if (i->Score() < min)
+		if (!IsWalkable(iPoint(cx, cy + 1)))
+			return IsWalkable(iPoint(cx + dx, cy + 1));
+		if (!IsWalkable(iPoint(cx, cy - 1)))
+			return IsWalkable(iPoint(cx + dx, cy - 1));
+	}
+	else
+	{
+		if (!IsWalkable(iPoint(cx + 1, cy)))
+			return IsWalkable(iPoint(cx + 1, cy + dy));
+		if (!IsWalkable(iPoint(cx - 1, cy)))
+			return IsWalkable(iPoint(cx - 1, cy + dy));
+	}
+
+	return false;
+}
+
+void WalkabilityMap::BuildJumpTables()
+{
+	jump_distances.assign(width * height * 8, -1);
+
+	//Straight directions first, the diagonals need them. Tiles are visited so the next one is already computed
+	static const uint order[8] = { 0, 2, 4, 6, 1, 3, 5, 7 };
+
+	for (uint i = 0; i < 8; ++i)
+	{
+		uint dir = order[i];
+		int dx = dir_x[dir];
+		int dy = dir_y[dir];
+
+		for (int row = 0; row < (int)height; ++row)
 		{
-			min = i->Score();
-			ret = i;
+			int y = (dy > 0) ? height - 1 - row : row;
+
+			for (int column = 0; column < (int)width; ++column)
+			{
+				int x = (dx > 0) ? width - 1 - column : column;
+				iPoint next(x + dx, y + dy);
+
+				if (IsWalkable(next) == false)
+				{
+					SetJumpDistance(x, y, dir, -1);
+					continue;
+				}
+
+				bool jump_point;
+				if (dx == 0 || dy == 0)
+				{
+					jump_point = IsForced(x, y, dx, dy);
+				}
+				else
+				{
+					jump_point = !IsWalkable(iPoint(x + dx, y)) || !IsWalkable(iPoint(x, y + dy)) ||
+						GetJumpDistance(next, dx > 0 ? 2 : 6) > 0 || GetJumpDistance(next, dy > 0 ? 4 : 0) > 0;
+				}
+
+				if (jump_point)
+				{
+					SetJumpDistance(x, y, dir, 1);
+				}
+				else
+				{
+					int next_distance = GetJumpDistance(next, dir);
+					SetJumpDistance(x, y, dir, (next_distance > 0) ? next_distance + 1 : next_distance - 1);
+				}
+			}
 		}
-		++i;
 	}
+}
+
+
+
+// PathHeap ------------------------------------------------------------------------
+struct HigherScore
+{
+	bool operator()(const PathNode* a, const PathNode* b) const
+	{
+		//Ties are broken by the heuristic to expand first the nodes closer to the destination
+		if (a->Score() == b->Score())
+			return a->h > b->h;
+		return a->Score() > b->Score();
+	}
+};
+
+void PathHeap::Push(PathNode* node)
+{
+	nodes.push_back(node);
+	push_heap(nodes.begin(), nodes.end(), HigherScore());
+}
+
+PathNode* PathHeap::Pop()
+{
+	pop_heap(nodes.begin(), nodes.end(), HigherScore());
+	PathNode* ret = nodes.back();
+	nodes.pop_back();
 
 	return ret;
 }
 
+bool PathHeap::Empty() const
+{
+	return nodes.empty();
+}
+
+void PathHeap::Clear()
+{
+	nodes.clear();
+}
+
+// PathGrid ------------------------------------------------------------------------
+PathGrid::PathGrid(uint width, uint height) : width(width), height(height), generation(0)
+{
+	open_stamps.resize(width * height, 0);
+	closed_stamps.resize(width * height, 0);
+	open_nodes.resize(width * height, NULL);
+}
+
+void PathGrid::NextGeneration()
+{
+	++generation;
+
+	//Overflow: old stamps could match again
+	if (generation == 0)
+	{
+		fill(open_stamps.begin(), open_stamps.end(), 0);
+		fill(closed_stamps.begin(), closed_stamps.end(), 0);
+		generation = 1;
+	}
+}
+
+bool PathGrid::IsClosed(const iPoint& pos) const
+{
+	return closed_stamps[pos.y * width + pos.x] == generation;
+}
+
+void PathGrid::SetClosed(const iPoint& pos)
+{
+	closed_stamps[pos.y * width + pos.x] = generation;
+}
+
+PathNode* PathGrid::GetOpen(const iPoint& pos) const
+{
+	uint index = pos.y * width + pos.x;
+	return (open_stamps[index] == generation) ? open_nodes[index] : NULL;
+}
+
+void PathGrid::SetOpen(const iPoint& pos, PathNode* node)
+{
+	uint index = pos.y * width + pos.x;
+	open_stamps[index] = generation;
+	open_nodes[index] = node;
+}
+
 // PathNode -------------------------------------------------------------------------
 PathNode::PathNode() : g(-1), h(-1), pos(-1, -1), parent(NULL)
 {}
@@ -197,153 +675,134 @@ PathNode::PathNode(int g, int h, const iPoint& pos, const PathNode* parent) : g(
 PathNode::PathNode(const PathNode& node) : g(node.g), h(node.h), pos(node.pos), parent(node.parent)
 {}
 
-void PathNode::IdentifySuccessors(PathList& successors, iPoint startNode, iPoint endNode, j1PathFinding* path_finder)const
+void PathNode::IdentifySuccessors(PathList& successors, iPoint startNode, iPoint endNode, const WalkabilityMap& map)const
 {
-	PathList neighbours;
-	this->FindWalkableAdjacents(neighbours, path_finder);
-
-	list<PathNode>::iterator neighbour = neighbours.list_nodes.begin();
-
-	while (neighbour != neighbours.list_nodes.end())
+	//Blocked neighbours are discarded by the jump tables
+	for (uint dir = 0; dir < 8; ++dir)
 	{
-		int dx = clamp(neighbour->pos.x - this->pos.x, -1, 1);
-		int dy = clamp(neighbour->pos.y - this->pos.y, -1, 1);
-
 		PathNode jump_point(-1, -1, iPoint(-1, -1), this);
-		bool succed = path_finder->Jump(this->pos.x, this->pos.y, dx, dy, startNode, endNode, jump_point);
+		bool succed = j1PathFinding::Jump(map, this->pos.x, this->pos.y, dir_x[dir], dir_y[dir], startNode, endNode, jump_point);
 
 		if (succed == true)
 			successors.list_nodes.push_back(jump_point);
-
-		++neighbour;
 	}
 }
 
-bool j1PathFinding::Jump(int cx, int cy, int dx, int dy, iPoint start, iPoint end,PathNode& new_node)
+// Steps from c to reach end walking in a straight direction, -1 if it is not on the way
+static int StepsTo(int cx, int cy, int dx, int dy, const iPoint& end)
 {
-	iPoint next(cx + dx, cy + dy);
+	if ((dx == 0 && end.x != cx) || (dy == 0 && end.y != cy))
+		return -1;
 
-	if (IsWalkable(next) == false)
-		return false;
+	int steps = (dx != 0) ? (end.x - cx) * dx : (end.y - cy) * dy;
+	return (steps > 0) ? steps : -1;
+}
 
-	if (next.x == end.x && next.y == end.y)
-	{
-		new_node.pos = next;
-		return true;
-	}
+// True if a straight jump of the given length from a tile with that table distance gets there before stopping
+static bool ReachesBeforeStop(int steps, int distance)
+{
+	return (distance > 0) ? steps <= distance : steps < -distance;
+}
 
-	//Diagonal
-	if (dx != 0 && dy != 0)
-	{
-		if (!IsWalkable(iPoint(cx + dx, cy)))
-		{
-			new_node.pos = next;
-			return true;
-		}
-		if (!IsWalkable(iPoint(cx, cy + dy)))
-		{
-			new_node.pos = next;
-			return true;
-		}
+bool j1PathFinding::Jump(const WalkabilityMap& map, int cx, int cy, int dx, int dy, iPoint start, iPoint end, PathNode& new_node)
+{
+	uint dir = 0;
+	while (dir_x[dir] != dx || dir_y[dir] != dy)
+		++dir;
+
+	int distance = map.GetJumpDistance(iPoint(cx, cy), dir);
+	int steps = abs(distance);
 
-		//Check also horizontal and vertical directions for forced neighbors
-		if (Jump(next.x, next.y, dx, 0, start, end, new_node) != NULL || Jump(next.x, next.y, 0, dy, start, end, new_node) != NULL)
+	if (dx == 0 || dy == 0)
+	{
+		//The destination is on the way before the jump point or the wall
+		int to_end = StepsTo(cx, cy, dx, dy, end);
+		if (to_end > 0 && ReachesBeforeStop(to_end, distance))
 		{
-			new_node.pos = next;
+			new_node.pos = end;
 			return true;
 		}
 	}
 	else
 	{
-		//Horizontal
-		if (dx != 0)
+		//Diagonal: stop earlier where the row or the column of the destination can be reached in a straight line
+		int goal_steps = -1;
+
+		int row_steps = (end.y - cy) * dy;
+		if (row_steps > 0)
 		{
-			if (!IsWalkable(iPoint(cx, cy + 1)))
-			{
-				if (IsWalkable(iPoint(cx + dx, cy + 1)))
-				{
-					new_node.pos = next;
-					return true;
-				}
-			}
-			else if (!IsWalkable(iPoint(cx, cy - 1)))
-			{
-				if (IsWalkable(iPoint(cx + dx, cy - 1)))
-				{
-					new_node.pos = next;
-					return true;
-				}
-			}
+			iPoint cross(cx + row_steps * dx, end.y);
+			int to_end = (end.x - cross.x) * dx;
+			if (to_end == 0 || (to_end > 0 && ReachesBeforeStop(to_end, map.GetJumpDistance(cross, dx > 0 ? 2 : 6))))
+				goal_steps = row_steps;
 		}
-		else //Vertical
+
+		int column_steps = (end.x - cx) * dx;
+		if (column_steps > 0 && (goal_steps == -1 || column_steps < goal_steps))
 		{
-			if (!IsWalkable(iPoint(cx + 1, cy)))
-			{
-				if (IsWalkable(iPoint(cx + 1, cy + dy)))
-				{
-					new_node.pos = next;
-					return true;
-				}
-			}
-			else if (!IsWalkable(iPoint(cx - 1, cy)))
-			{
-				if (IsWalkable(iPoint(cx - 1, cy + dy)))
-				{
-					new_node.pos = next;
-					return true;
-				}
-			}
+			iPoint cross(end.x, cy + column_steps * dy);
+			int to_end = (end.y - cross.y) * dy;
+			if (to_end == 0 || (to_end > 0 && ReachesBeforeStop(to_end, map.GetJumpDistance(cross, dy > 0 ? 4 : 0))))
+				goal_steps = column_steps;
 		}
 
+		if (goal_steps > 0 && ReachesBeforeStop(goal_steps, distance))
+		{
+			new_node.pos.create(cx + goal_steps * dx, cy + goal_steps * dy);
+			return true;
+		}
 	}
 
-	//Forced neighbour not found try next jump point
-	return Jump(next.x, next.y, dx, dy, start, end, new_node);
+	if (distance < 0)
+		return false;
+
+	new_node.pos.create(cx + steps * dx, cy + steps * dy);
+	return true;
 }
 
-uint PathNode::FindWalkableAdjacents(PathList& list_to_fill, j1PathFinding* path_finder) const
+uint PathNode::FindWalkableAdjacents(PathList& list_to_fill, const WalkabilityMap& map) const
 {
 	iPoint cell;
 	uint before = list_to_fill.list_nodes.size();
 
 	// north
 	cell.create(pos.x, pos.y - 1);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	//north-east
 	cell.create(pos.x + 1, pos.y - 1);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	// east
 	cell.create(pos.x + 1, pos.y);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	//south-east
 	cell.create(pos.x + 1, pos.y + 1);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	// south
 	cell.create(pos.x, pos.y + 1);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	//south-west
 	cell.create(pos.x - 1, pos.y + 1);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 	
 	// west
 	cell.create(pos.x - 1, pos.y);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	//nord-west
 	cell.create(pos.x - 1, pos.y - 1);
-	if (path_finder->IsWalkable(cell))
+	if (map.IsWalkable(cell))
 		list_to_fill.list_nodes.push_back(PathNode(-1, -1, cell, this));
 
 	return list_to_fill.list_nodes.size();
@@ -388,7 +847,7 @@ iPoint j1PathFinding::FindNearestWalkable(const iPoint& origin)
 }
 
 // Actual A* algorithm -----------------------------------------------
-int j1PathFinding::CreatePath(const iPoint& origin, const iPoint& destination)
+int j1PathFinding::CreatePath(const iPoint& origin, const iPoint& destination, PATH_PRIORITY priority, const Unit* owner)
 {
 	int ret = -1;
 
@@ -412,17 +871,39 @@ int j1PathFinding::CreatePath(const iPoint& origin, const iPoint& destination)
 			}
 				
 		}
+		//The owner doesn't need its old paths anymore
+		if (owner != NULL)
+			CancelPaths(owner);
+
 		Path* path = new Path();
 
 		paths_to_calculate.insert(pair<uint, Path*>(++current_id, path));
 
-		// Start pushing the origin in the open list
-		path->open.list_nodes.push_back(PathNode(0, 0, actual_origin, NULL));
-
+		path->walk_map = walk_map;
 		path->origin = actual_origin;
 		path->destination = destination;
+		path->map_version = map_version;
+		path->priority = priority;
+		path->deadline = clock.Read() + deadlines[priority];
+		path->owner = owner;
+
+		//Same request already solved: the path is ready this frame
+		CachedPath cached(PathCacheKey(actual_origin, destination, map_version), vector<iPoint>(), false);
+		if (FindCachedPath(cached.key, cached))
+		{
+			path->path_finished = cached.path;
+			path->partial = cached.partial;
+			path->from_cache = true;
+			path->completed.store(true, memory_order_release);
 
-		//CalculatePath(path);
+			return current_id;
+		}
+
+		if (actual_origin.DistanceManhattan(destination) >= MIN_HIERARCHICAL_DISTANCE)
+			path->hierarchy = hierarchy;
+
+		//Solved in the background if possible, otherwise PreUpdate calculates it
+		path->threaded = solvers.Push(path);
 
 		ret = current_id; //Id of the path created
 	}
@@ -430,28 +911,145 @@ int j1PathFinding::CreatePath(const iPoint& origin, const iPoint& destination)
 	return ret;
 }
 
-int j1PathFinding::CalculatePath(Path* path, int max_iterations)
+void j1PathFinding::CancelPaths(const Unit* owner, uint keep_id)
 {
-	int it_time = 0;
+	if (owner == NULL)
+		return;
 
-	do
+	std::map<uint, Path*>::iterator path = paths_to_calculate.begin();
+	while (path != paths_to_calculate.end())
 	{
-		//Debug
-		timer.Start();
+		if (path->second->owner == owner && path->first != keep_id && path->second->completed.load(memory_order_acquire) == false)
+		{
+			if (path->second->threaded)
+			{
+				//The solver thread could be working on it, it will finish it
+				path->second->cancelled.store(true, memory_order_release);
+			}
+			else
+			{
+				CancelPath(path->second);
+				ReleaseGrid(path->second->grid);
+				path->second->grid = NULL;
+			}
+		}
+		++path;
+	}
+}
 
+void j1PathFinding::CancelPath(Path* path)
+{
+	path->cancelled.store(true, memory_order_relaxed);
+	path->path_finished.clear();
+	path->partial = false;
+	FinishPath(path);
+}
+
+void j1PathFinding::StartPath(Path* path, PathGrid* grid)
+{
+	path->started = true;
+	grid->NextGeneration();
+
+	// Start pushing the origin in the open list
+	path->nodes.push_back(PathNode(0, 0, path->origin, NULL));
+	PathNode* origin = &path->nodes.back();
+
+	grid->SetOpen(origin->pos, origin);
+	path->open.Push(origin);
+}
+
+void j1PathFinding::FinishPath(Path* path)
+{
+	path->open.Clear();
+	path->nodes.clear();
+
+	//Last write: once it is true the main thread can read path_finished
+	path->completed.store(true, memory_order_release);
+}
+
+PathGrid* j1PathFinding::AcquireGrid()
+{
+	if (free_grids.empty())
+		return new PathGrid(width, height);
+
+	PathGrid* ret = free_grids.front();
+	free_grids.pop_front();
+
+	return ret;
+}
+
+void j1PathFinding::ReleaseGrid(PathGrid* grid)
+{
+	if (grid == NULL)
+		return;
+
+	//The map changed while the path was being calculated
+	if (grid->width != width || grid->height != height)
+	{
+		delete grid;
+		return;
+	}
+
+	free_grids.push_back(grid);
+}
+
+double j1PathFinding::CalculatePath(Path* path, double max_time)
+{
+	if (path->grid == NULL)
+		path->grid = AcquireGrid();
+
+	double it_time = SolvePath(path, path->grid, max_time);
+
+	if (path->completed)
+	{
+		ReleaseGrid(path->grid);
+		path->grid = NULL;
+	}
+
+	return it_time;
+}
+
+double j1PathFinding::SolvePath(Path* path, PathGrid* grid, double max_time)
+{
+	j1PerfTimer timer;
+
+	if (path->cancelled.load(memory_order_acquire))
+	{
+		CancelPath(path);
+		return timer.ReadMs() * 1000.0;
+	}
+
+	//Long paths search the cluster graph first. If it fails the full search decides
+	if (path->hierarchy && path->started == false)
+	{
+		if (SolveHierarchicalPath(path, grid, max_time))
+			return timer.ReadMs() * 1000.0;
+
+		path->hierarchy.reset();
+	}
+
+	if (path->started == false)
+		StartPath(path, grid);
+
+	const WalkabilityMap& map = *path->walk_map;
+
+	while (path->open.Empty() == false)
+	{
 		// Move the lowest score cell from open list to the closed list
-		list<PathNode>::iterator lowest = path->open.GetNodeLowestScore();
-		path->closed.list_nodes.push_back(*lowest);
-		path->open.list_nodes.erase(lowest);
-		list<PathNode>::iterator node = --path->closed.list_nodes.end();
+		PathNode* node = path->open.Pop();
+
+		// Skip nodes already closed or replaced by a better one
+		if (grid->IsClosed(node->pos) || grid->GetOpen(node->pos) != node)
+			continue;
 
+		grid->SetClosed(node->pos);
 
 		// If destination was added, we are done!
 		if (node->pos == path->destination)
 		{
 			path->path_finished.clear();
 			// Backtrack to create the final path
-			const PathNode* path_node = &(*node);
+			const PathNode* path_node = node;
 
 			while (path_node)
 			{
@@ -465,138 +1063,160 @@ int j1PathFinding::CalculatePath(Path* path, int max_iterations)
 			while (start < end)
 				SWAP(*start++, *end--);
 
-			path->completed = true;
+			FinishPath(path);
 
-			break;
+			return timer.ReadMs() * 1000.0;
 		}
 
 		// Fill a list with all adjacent nodes
 		path->adjacent.list_nodes.clear();
-		node->IdentifySuccessors(path->adjacent, path->origin, path->destination, this);
+		node->IdentifySuccessors(path->adjacent, path->origin, path->destination, map);
 
 
 		list<PathNode>::iterator i = path->adjacent.list_nodes.begin();
 
 		while (i != path->adjacent.list_nodes.end())
 		{
-			if (path->closed.Find(i->pos) != path->closed.list_nodes.end())
+			if (grid->IsClosed(i->pos))
 			{
 				++i;
 				continue;
 			}
 
-			list<PathNode>::iterator adjacent_in_open = path->open.Find(i->pos);
+			i->CalculateF(path->destination);
 
-			if (adjacent_in_open == path->open.list_nodes.end())
-			{
-				i->CalculateF(path->destination);
-				path->open.list_nodes.push_back(*i);
-			}
-			else
+			PathNode* adjacent_in_open = grid->GetOpen(i->pos);
+
+			// New tile or better way to reach it: the old node stays in the heap and will be skipped
+			if (adjacent_in_open == NULL || adjacent_in_open->g > i->g)
 			{
-				if (adjacent_in_open->g > i->g + 1)
-				{
-					adjacent_in_open->parent = i->parent;
-					adjacent_in_open->CalculateF(path->destination);
-				}
+				path->nodes.push_back(*i);
+				PathNode* new_node = &path->nodes.back();
+
+				grid->SetOpen(new_node->pos, new_node);
+				path->open.Push(new_node);
 			}
 			++i;
 		}
 
-		it_time += timer.Read();
+		if (max_time >= 0 && timer.ReadMs() * 1000.0 >= max_time)
+			return timer.ReadMs() * 1000.0;
 
-		if (it_time >= max_iterations)
-			break;
+		//Superseded while it was being solved
+		if (path->cancelled.load(memory_order_relaxed))
+		{
+			CancelPath(path);
+			return timer.ReadMs() * 1000.0;
+		}
+	}
 
-	} while (path->open.list_nodes.size() > 0);
+	//Can be a solver thread, PreUpdate() logs it
+	path->not_found = true;
+	path->path_finished.clear();
+	FinishPath(path);
 
-	return it_time;
+	return timer.ReadMs() * 1000.0;
 }
 
-bool j1PathFinding::CreateLineWorld(const iPoint& origin, const iPoint& destination, int max_error)
+bool j1PathFinding::SolveHierarchicalPath(Path* path, PathGrid* grid, double max_time)
 {
-	int count_error = 0; //3 hits to non walkable tiles are allowed 
-	bool ret = true;
+	j1PerfTimer timer;
 
-	iPoint p1 = origin;
-	iPoint p2 = destination;
+	if (path->waypoints.empty())
+	{
+		if (!path->abstract_search)
+		{
+			path->abstract_search.reset(new AbstractSearch());
+			if (path->hierarchy->StartAbstractPath(path->origin, path->destination, *path->abstract_search) == false)
+			{
+				path->abstract_search.reset();
+				return false;
+			}
+		}
 
-	bool steep = (abs(p2.y - p1.y) > abs(p2.x - p1.x));
+		//Out of time, it goes on next frame
+		if (path->hierarchy->ContinueAbstractPath(*path->abstract_search, path->waypoints, max_time) == false)
+			return true;
 
-	if (steep)
-	{
-		swap(p1.x, p1.y);
-		swap(p2.x, p2.y);
-	}
+		path->abstract_search.reset();
+		if (path->waypoints.empty())
+			return false;
 
-	if (p1.x > p2.x)
-	{
-		swap(p1.x, p2.x);
-		swap(p1.y, p2.y);
+		path->path_finished.clear();
+		path->path_finished.push_back(path->origin);
+		path->next_waypoint = 1;
+		path->refined_segments = 0;
 	}
 
-	int dx = p2.x - p1.x;
-	int dy = abs(p2.y - p1.y);
+	//Only the segments the unit is about to walk are refined
+	while (path->next_waypoint < path->waypoints.size() && path->refined_segments < REFINE_SEGMENTS)
+	{
+		//Superseded while it was being refined
+		if (path->cancelled.load(memory_order_relaxed))
+		{
+			path->segment.reset();
+			CancelPath(path);
+			return true;
+		}
 
-	int error = dx / 2;
-	int ystep = (p1.y < p2.y) ? 1 : -1;
-	int y = p1.y;
+		const iPoint& from = path->waypoints[path->next_waypoint - 1];
+		const iPoint& to = path->waypoints[path->next_waypoint];
 
-	const int max_x = p2.x;
+		//Entrance crossing, the tiles are adjacent
+		if (abs(to.x - from.x) <= 1 && abs(to.y - from.y) <= 1)
+		{
+			path->path_finished.push_back(to);
+			++path->next_waypoint;
+			continue;
+		}
 
-	for (int x = p1.x; x < max_x; x++)
-	{
-		if (steep)
+		double remaining = -1;
+		if (max_time >= 0)
 		{
-			if (iPoint(y,x) != origin)
-			{
-				iPoint p = App->map->WorldToMap(y, x, COLLIDER_MAP);
-				if (IsWalkable(p) == false)
-				{
-					++count_error;
-					if (count_error >= max_error)
-					{
-						hitted_world.x = y;
-						hitted_world.y = x;
-						return false;
-					}
-					
-				}
-			}
+			remaining = max_time - timer.ReadMs() * 1000.0;
+			if (remaining <= 0)
+				return true;
 		}
-		else
+
+		if (!path->segment)
 		{
-			if (iPoint(x,y) != origin)
-			{
-				iPoint p = App->map->WorldToMap(x, y, COLLIDER_MAP);
-				if (IsWalkable(p) == false)
-				{
-					++count_error;
-					if (count_error >= max_error)
-					{
-						hitted_world.x = x;
-						hitted_world.y = y;
-						return false;
-					}
-				}
-			}
+			path->segment.reset(new Path());
+			path->segment->walk_map = path->walk_map;
+			path->segment->origin = from;
+			path->segment->destination = to;
 		}
 
-		error -= dy;
-		if (error < 0)
+		SolvePath(path->segment.get(), grid, remaining);
+
+		//Out of time, it goes on next frame
+		if (path->segment->completed.load(memory_order_relaxed) == false)
+			return true;
+
+		const vector<iPoint>& refined = path->segment->path_finished;
+		if (refined.empty())
 		{
-			y += ystep;
-			error += dx;
+			path->segment.reset();
+			path->waypoints.clear();
+			path->path_finished.clear();
+			return false;
 		}
+
+		path->path_finished.insert(path->path_finished.end(), refined.begin() + 1, refined.end());
+		path->segment.reset();
+		++path->next_waypoint;
+		++path->refined_segments;
 	}
 
+	path->partial = path->next_waypoint < path->waypoints.size();
+	path->waypoints.clear();
+	FinishPath(path);
+
 	return true;
 }
 
-
-bool j1PathFinding::CreateLine(const iPoint& origin, const iPoint& destination)
+bool j1PathFinding::CreateLineWorld(const iPoint& origin, const iPoint& destination, int max_error)
 {
-
+	int count_error = 0; //3 hits to non walkable tiles are allowed 
 	bool ret = true;
 
 	iPoint p1 = origin;
@@ -625,29 +1245,36 @@ bool j1PathFinding::CreateLine(const iPoint& origin, const iPoint& destination)
 
 	const int max_x = p2.x;
 
-	for (int x = p1.x; x < max_x; x++)
+	int x = p1.x;
+	while (x < max_x)
 	{
-		if (steep)
-		{
-			if (IsWalkable(iPoint(y, x)) == false)
-			{
-				hitted_tile.x = y;
-				hitted_tile.y = x;
-				return false;
-			}
-				
-		}
-		else
+		//Pixels until y changes. Only checked one by one if they are not all on walkable tiles
+		int run = (dy == 0) ? max_x - x : error / dy + 1;
+		run = MIN(run, max_x - x);
+
+		bool walkable = steep ? IsWorldSpanWalkable(iPoint(y, x), iPoint(y, x + run - 1)) : IsWorldSpanWalkable(iPoint(x, y), iPoint(x + run - 1, y));
+
+		for (int i = x; i < x + run && walkable == false; ++i)
 		{
-			if (IsWalkable(iPoint(x, y)) == false)
+			iPoint world = steep ? iPoint(y, i) : iPoint(i, y);
+
+			if (world != origin)
 			{
-				hitted_tile.x = x;
-				hitted_tile.y = y;
-				return false;
+				iPoint p = App->map->WorldToMap(world.x, world.y, COLLIDER_MAP);
+				if (IsWalkable(p) == false)
+				{
+					++count_error;
+					if (count_error >= max_error)
+					{
+						hitted_world = world;
+						return false;
+					}
+				}
 			}
 		}
 
-		error -= dy;
+		x += run;
+		error -= run * dy;
 		if (error < 0)
 		{
 			y += ystep;
@@ -658,7 +1285,35 @@ bool j1PathFinding::CreateLine(const iPoint& origin, const iPoint& destination)
 	return true;
 }
 
+bool j1PathFinding::IsWorldSpanWalkable(const iPoint& a, const iPoint& b) const
+{
+	if (!walk_map)
+		return false;
 
+	iPoint tile_a = App->map->WorldToMap(a.x, a.y, COLLIDER_MAP);
+	iPoint tile_b = App->map->WorldToMap(b.x, b.y, COLLIDER_MAP);
+	int blocked;
+
+	if (tile_a.y == tile_b.y && tile_a.x <= tile_b.x)
+		return walk_map->IsRowWalkable(tile_a.y, tile_a.x, tile_b.x, blocked);
+
+	if (tile_a.x == tile_b.x && tile_a.y <= tile_b.y)
+		return walk_map->IsColumnWalkable(tile_a.x, tile_a.y, tile_b.y, blocked);
+
+	return false;
+}
+
+
+bool j1PathFinding::CreateLine(const iPoint& origin, const iPoint& destination)
+{
+	if (!walk_map)
+	{
+		hitted_tile = origin;
+		return false;
+	}
+
+	return walk_map->IsLineWalkable(origin, destination, hitted_tile);
+}
 
 iPoint j1PathFinding::GetLineTile()const
 {
@@ -680,7 +1335,7 @@ bool j1PathFinding::PathFinished(uint id)const
 		return false;
 	}
 
-	return result->second->completed;
+	return result->second->completed.load(memory_order_acquire);
 }
 
 vector<iPoint> j1PathFinding::GetPath(uint id)const
@@ -694,13 +1349,52 @@ vector<iPoint> j1PathFinding::GetPath(uint id)const
 	}
 	else
 	{
-		ret = result->second->path_finished;
+		if (result->second->completed.load(memory_order_acquire))
+			ret = result->second->path_finished;
 	}
 
 	return ret;
 }
 
-Path::Path()
+bool j1PathFinding::GetPathContinuation(uint id, iPoint& goal)const
+{
+	std::map<uint, Path*>::const_iterator result = paths_to_calculate.find(id);
+
+	if (result == paths_to_calculate.end() || result->second->completed.load(memory_order_acquire) == false)
+		return false;
+
+	goal = result->second->destination;
+	return result->second->partial;
+}
+
+PATH_PRIORITY j1PathFinding::GetPathPriority(uint id)const
 {
-	completed = false;
-}
\ No newline at end of file
+	std::map<uint, Path*>::const_iterator result = paths_to_calculate.find(id);
+
+	if (result == paths_to_calculate.end())
+		return PATH_PLAYER;
+
+	return result->second->priority;
+}
+
+PathCacheKey::PathCacheKey(const iPoint& origin, const iPoint& destination, uint map_version) : origin(origin), destination(destination), map_version(map_version)
+{}
+
+bool PathCacheKey::operator <(const PathCacheKey& key) const
+{
+	if (map_version != key.map_version)
+		return map_version < key.map_version;
+	if (origin.x != key.origin.x)
+		return origin.x < key.origin.x;
+	if (origin.y != key.origin.y)
+		return origin.y < key.origin.y;
+	if (destination.x != key.destination.x)
+		return destination.x < key.destination.x;
+	return destination.y < key.destination.y;
+}
+
+CachedPath::CachedPath(const PathCacheKey& key, const vector<iPoint>& path, bool partial) : key(key), path(path), partial(partial)
+{}
+
+Path::Path() : grid(NULL), map_version(0), priority(PATH_PLAYER), deadline(0), owner(NULL), next_waypoint(0), refined_segments(0), from_cache(false), started(false), partial(false), not_found(false), threaded(false), collect(false), completed(false), cancelled(false)
+{}
\ No newline at end of file
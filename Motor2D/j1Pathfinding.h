@@ -4,17 +4,97 @@
 #include "j1Module.h"
 #include "p2Point.h"
 #include "j1Timer.h"
+#include "j1PerfTimer.h"
+#include "PathSolverPool.h"
+#include "PathHierarchy.h"
+#include "FlowField.h"
 
 #include <iostream>
 #include <vector>
 #include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
 
-#define MAX_ITERATIONS 26
 #define INVALID_WALK_CODE 255
-
+#define DEFAULT_PATH_THREADS 2
+#define MIN_HIERARCHICAL_DISTANCE (2 * CLUSTER_SIZE) //Shorter paths skip the cluster graph
+#define REFINE_SEGMENTS 2 //Abstract segments refined per hierarchical path
+#define FLOW_FIELD_CACHE 8 //Destinations with a flow field kept
+#define PATH_CACHE_SIZE 128 //Solved paths kept to answer repeated requests
+#define DEFAULT_PATH_BUDGET 2000 //Microseconds per frame to solve paths in the main thread
+#define DEFAULT_PLAYER_DEADLINE 50 //Ms to solve a path before it goes in front of the others
+#define DEFAULT_CHASE_DEADLINE 250
+#define DEFAULT_PATROL_DEADLINE 1000
+
+// 8 directions clockwise from north
+static const int dir_x[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+static const int dir_y[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+
+class Unit;
 struct PathNode;
 struct PathList;
+struct PathGrid;
 struct Path;
+
+struct PathCacheKey
+{
+	PathCacheKey(const iPoint& origin, const iPoint& destination, uint map_version);
+	bool operator <(const PathCacheKey& key) const;
+
+	iPoint origin;
+	iPoint destination;
+	uint map_version;
+};
+
+struct CachedPath
+{
+	CachedPath(const PathCacheKey& key, const vector<iPoint>& path, bool partial);
+
+	PathCacheKey key;
+	vector<iPoint> path;
+	bool partial;
+};
+
+// Immutable copy of the walkability map. Each path keeps a reference so it can be solved in another thread
+struct WalkabilityMap
+{
+	WalkabilityMap(uint width, uint height, const uchar* data);
+
+	bool CheckBoundaries(const iPoint& pos) const;
+	bool IsWalkable(const iPoint& pos) const;
+	uchar GetTileAt(const iPoint& pos) const;
+
+	//JPS+: steps from pos to the next jump point (> 0) or to the first blocked tile (< 0) in the direction
+	int GetJumpDistance(const iPoint& pos, uint dir) const;
+
+	//Tiles from..to (from <= to) of a row or a column tested a word at a time. blocked is the first non walkable one
+	bool IsRowWalkable(int y, int from, int to, int& blocked) const;
+	bool IsColumnWalkable(int x, int from, int to, int& blocked) const;
+
+	//Same tiles as the Bresenham line of CreateLine, tested in row or column spans
+	bool IsLineWalkable(const iPoint& origin, const iPoint& destination, iPoint& hitted) const;
+
+	uint width;
+	uint height;
+	vector<uchar> data;
+
+private:
+
+	void BuildJumpTables();
+	void BuildBitsets();
+	bool IsForced(int cx, int cy, int dx, int dy) const;
+	void SetJumpDistance(int x, int y, uint dir, int distance);
+
+	vector<short> jump_distances; //8 per tile
+
+	//Walkability packed in 64 bit words, by rows and by columns
+	uint row_words;
+	uint column_words;
+	vector<uint64> row_bits;
+	vector<uint64> column_bits;
+};
+
 // --------------------------------------------------
 class j1PathFinding : public j1Module
 {
@@ -40,11 +120,14 @@ public:
 	// Set Map
 	void SetMap(uint width, uint height, uchar* data);
 
-	int CreatePath(const iPoint& origin, const iPoint& destination);
+	//A new path of the same owner cancels the ones it still has pending. Paths shared by several units have no owner
+	int CreatePath(const iPoint& origin, const iPoint& destination, PATH_PRIORITY priority = PATH_PLAYER, const Unit* owner = NULL);
+	void CancelPaths(const Unit* owner, uint keep_id = 0); //keep_id is not cancelled
 
 	bool CheckBoundaries(const iPoint& pos) const;
 	bool IsWalkable(const iPoint& pos) const;
 	uchar GetTileAt(const iPoint& pos) const;
+	const WalkabilityMap* GetWalkabilityMap() const; //NULL if there is no map
 
 	bool CreateLine(const iPoint& origin, const iPoint& destination);
 	bool CreateLineWorld(const iPoint& origin, const iPoint& destination, int max_error = 0); //Uses world coordinates
@@ -52,30 +135,78 @@ public:
 	iPoint GetLineTile()const; //Returns the last hitted tile
 	iPoint GetLineWorld()const; //Return the last hitted position
 
-	bool Jump(int cx, int cy, int dx, int dy, iPoint start, iPoint end, PathNode& new_node);
+	static bool Jump(const WalkabilityMap& map, int cx, int cy, int dx, int dy, iPoint start, iPoint end, PathNode& new_node);
 
 	//Check path status
 	bool PathFinished(uint id)const;
 	vector<iPoint> GetPath(uint id)const;
+	//True if only the first part of the path was refined. The rest must be requested from the end of it to the goal
+	bool GetPathContinuation(uint id, iPoint& goal)const;
+	PATH_PRIORITY GetPathPriority(uint id)const;
+
+	//Flow field to the destination shared by all the units going there. NULL if the destination is not walkable
+	const FlowField* GetFlowField(const iPoint& destination);
+
+	//Path cache stats
+	uint GetCacheHits()const;
+	uint GetCacheMisses()const;
+
+	//Solves the path with the given grid until it is completed or max_time (us) is reached. max_time < 0 means no limit
+	//Returns the time spent (us). Can be called from the solver threads
+	static double SolvePath(Path* path, PathGrid* grid, double max_time);
 
 private:
 
-	int CalculatePath(Path* path, int max_iterations); //Returns the number of iterations
+	double CalculatePath(Path* path, double max_time); //Returns the time spent (us)
+	static void CancelPath(Path* path);
+	static void StartPath(Path* path, PathGrid* grid);
+	//False if the full search has to be used. Out of time the path is left not completed, the next call goes on from the same segment
+	static bool SolveHierarchicalPath(Path* path, PathGrid* grid, double max_time);
+	static void FinishPath(Path* path);
+
+	PathGrid* AcquireGrid();
+	void ReleaseGrid(PathGrid* grid);
+
+	void ClearFlowFields();
+
+	//Path cache. Entries are only valid for the map version they were solved with
+	bool FindCachedPath(const PathCacheKey& key, CachedPath& result);
+	void StoreCachedPath(const Path* path);
+	void ClearPathCache();
 
 	iPoint FindNearestWalkable(const iPoint& origin);
+
+	//True if the world points from a to b (same row or column) are all on walkable tiles of one map row or column
+	bool IsWorldSpanWalkable(const iPoint& a, const iPoint& b) const;
 	
 private:
 
 	uint width;
 	uint height;
-	uchar* map;
+	shared_ptr<const WalkabilityMap> walk_map;
+	shared_ptr<const PathHierarchy> hierarchy;
 	iPoint hitted_tile;
 	iPoint hitted_world;
 	std::map<uint, Path*> paths_to_calculate;
+	list<PathGrid*> free_grids; //Grids not used by any path, ready to be reused
+	list<FlowField*> flow_fields; //Most recently used first
+
+	list<CachedPath> path_cache; //Most recently used first
+	std::map<PathCacheKey, list<CachedPath>::iterator> path_cache_index;
+	uint map_version = 0;
+	uint cache_hits = 0;
+	uint cache_misses = 0;
 
 	uint current_id = 0;
 
-	j1Timer timer;
+	PathSolverPool solvers;
+	uint num_threads = DEFAULT_PATH_THREADS;
+
+	//Scheduler of the paths solved in the main thread
+	double budget = DEFAULT_PATH_BUDGET; //us per frame
+	uint deadlines[PATH_PRIORITIES]; //ms
+	j1Timer clock; //Time the deadlines are measured with
+	vector<Path*> schedule;
 
 
 };
@@ -89,11 +220,11 @@ struct PathNode
 	PathNode(int g, int h, const iPoint& pos, const PathNode* parent);
 	PathNode(const PathNode& node);
 
-	uint FindWalkableAdjacents(PathList& list_to_fill, j1PathFinding* path_finder) const;
+	uint FindWalkableAdjacents(PathList& list_to_fill, const WalkabilityMap& map) const;
 	int Score() const;
 	int CalculateF(const iPoint& destination);
 
-	void IdentifySuccessors(PathList& list_to_fill, iPoint startNode, iPoint endNode, j1PathFinding* path_finder)const;
+	void IdentifySuccessors(PathList& list_to_fill, iPoint startNode, iPoint endNode, const WalkabilityMap& map)const;
 
 	int g;
 	int h;
@@ -104,26 +235,78 @@ struct PathNode
 // Helper struct to include a list of path nodes
 struct PathList
 {
-	bool Contains(const iPoint& point) const;
-	list<PathNode>::iterator Find(const iPoint& point);
-	list<PathNode>::iterator GetNodeLowestScore();
-
 	list<PathNode> list_nodes;
 };
 
+// Binary min-heap of the open nodes ordered by Score()
+struct PathHeap
+{
+	void Push(PathNode* node);
+	PathNode* Pop();
+	bool Empty() const;
+	void Clear();
+
+	vector<PathNode*> nodes;
+};
+
+// Map sized grid to know in O(1) if a tile is open or closed.
+// Cells are only valid if their stamp matches the current generation, so a new search doesn't need to clear the grid
+struct PathGrid
+{
+	PathGrid(uint width, uint height);
+
+	void NextGeneration();
+
+	bool IsClosed(const iPoint& pos) const;
+	void SetClosed(const iPoint& pos);
+
+	PathNode* GetOpen(const iPoint& pos) const;
+	void SetOpen(const iPoint& pos, PathNode* node);
+
+	uint width;
+	uint height;
+	uint generation;
+
+	vector<uint> open_stamps;
+	vector<uint> closed_stamps;
+	vector<PathNode*> open_nodes; //Best node found for each open tile
+};
+
 struct Path
 {
 	Path();
-	PathList open;
-	PathList closed;
+	shared_ptr<const WalkabilityMap> walk_map;
+	shared_ptr<const PathHierarchy> hierarchy; //Only set for long paths
+	PathHeap open;
+	PathGrid* grid;
+	deque<PathNode> nodes; //Storage of all the nodes created. Deque keeps the parent pointers valid
 	PathList adjacent;
 
 	iPoint origin;
 	iPoint destination;
+	uint map_version;
+
+	PATH_PRIORITY priority;
+	uint deadline; //Time (ms) it should be solved by
+	const Unit* owner; //Only compared, never accessed
 
 	vector<iPoint> path_finished;
 
-	bool completed;
+	//Hierarchical paths are refined a segment at a time, the main loop can split them between frames
+	unique_ptr<AbstractSearch> abstract_search; //Kept while the abstract search isn't finished
+	vector<iPoint> waypoints;
+	uint next_waypoint; //End of the segment being refined
+	uint refined_segments;
+	unique_ptr<Path> segment; //Search of that segment, kept while it isn't completed
+
+	bool from_cache;
+	bool started;
+	bool partial; //Ends before the destination
+	bool not_found; //Solved without reaching the destination, logged when it's collected
+	bool threaded; //Solved by the solver threads instead of the main loop
+	bool collect; //Completed since last frame, can be deleted on the next one
+	atomic<bool> completed; //Written last by the solver, path_finished is safe to read once it is true
+	atomic<bool> cancelled; //Superseded by a newer path of the same owner, it is completed empty
 };
 
 #endif // __j1PATHFINDING_H__
\ No newline at end of file
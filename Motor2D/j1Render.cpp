@@ -25,9 +25,7 @@ j1Render::j1Render() : j1Module()
 	background.b = 0;
 	background.a = 0;
 
-	blit_sprites.clear();
-	priority_sprites.clear();
-	ui_sprites.clear();
+	queue.Clear();
 }
 
 // Destructor
@@ -142,37 +140,9 @@ bool j1Render::PreUpdate()
 
 bool j1Render::Update(float dt)
 {
-	
-
-	//Sort Sprites and blit them
-	blit_sprites.sort([](const Sprite* a, const Sprite* b) { return a->position.y < b->position.y; });
-
-	list<Sprite*>::iterator i = blit_sprites.begin();
-
-	while (i != blit_sprites.end())
-	{
-		Blit((*i)->texture, (*i)->position.x, (*i)->position.y, &(*i)->rect, (*i)->alpha);
-		++i;
-	}
-
-	//Sort Priority Sprites and blit them
-	priority_sprites.sort([](const Sprite* a, const Sprite* b) { return a->position.y < b->position.y; });
-
-	list<Sprite*>::iterator j = priority_sprites.begin();
-
-	while (j != priority_sprites.end())
-	{
-		Blit((*j)->texture, (*j)->position.x, (*j)->position.y, &(*j)->rect, (*j)->alpha);
-		++j;
-	}
-
-	list<Sprite>::iterator u = ui_sprites.begin();
-	while (u != ui_sprites.end())
-	{
-		Blit((u)->texture, (u)->position.x, (u)->position.y, &(u)->rect, (u)->alpha, u->size);
-		++u;
-	}
-
+	//Sort Sprites, Priority Sprites and UI and blit them
+	queue.Sort();
+	queue.Submit(renderer, camera);
 
 	return true;
 }
@@ -182,9 +152,7 @@ bool j1Render::PostUpdate()
 	SDL_SetRenderDrawColor(renderer, background.r, background.g, background.g, background.a);
 	SDL_RenderPresent(renderer);
 
-	blit_sprites.clear();
-	priority_sprites.clear();
-	ui_sprites.clear();
+	queue.Clear();
 
 	return true;
 }
@@ -194,9 +162,7 @@ bool j1Render::CleanUp()
 {
 	LOG("Destroying SDL render");
 
-	blit_sprites.clear();
-	priority_sprites.clear();
-	ui_sprites.clear();
+	queue.Clear();
 
 	SDL_DestroyRenderer(renderer);
 	return true;
@@ -252,22 +218,12 @@ iPoint j1Render::ScreenToWorld(int x, int y) const
 
 void j1Render::BlitUI(Sprite _sprite)
 {
-	
-		ui_sprites.push_back(_sprite);
-	
-		
+	queue.PushCopy(LAYER_UI, _sprite);
 }
 
 void j1Render::Blit(Sprite* _sprite, bool priority)
 {
-	if (_sprite != NULL)
-	{
-		if (priority == false)
-			blit_sprites.push_back(_sprite);
-
-		else
-			priority_sprites.push_back(_sprite);
-	}
+	queue.Push((priority) ? LAYER_PRIORITY : LAYER_SPRITES, _sprite);
 }
 bool j1Render::Blit(SDL_Texture* texture, int x, int y, const SDL_Rect* section,uint alpha, float scale, double angle, int pivot_x, int pivot_y) const
 {
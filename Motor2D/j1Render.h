@@ -4,6 +4,7 @@
 #include "SDL/include/SDL.h"
 #include "p2Point.h"
 #include "j1Module.h"
+#include "RenderQueue.h"
 #include <list>
 
 #define CAMERA_TRANSITION_RADIUS 23
@@ -95,9 +96,8 @@ private:
 	//Next variable is needed in case the camera can only move around a rectangle
 	SDL_Rect quad_boundaries;
 
-	list<Sprite*> blit_sprites;
-	list<Sprite*> priority_sprites;
-	list<Sprite> ui_sprites;
+	//Sprites, priority sprites and UI of this frame
+	RenderQueue queue;
 
 	bool lock_after_transition = false; //Locks the camera after a transition
 
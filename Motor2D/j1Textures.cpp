@@ -57,6 +57,8 @@ bool j1Textures::CleanUp()
 	}
 
 	textures.clear();
+	cache.clear();
+	entries.clear();
 	IMG_Quit();
 	return true;
 }
@@ -64,6 +66,15 @@ bool j1Textures::CleanUp()
 // Load new texture from file path
 SDL_Texture* const j1Textures::Load(const char* path)
 {
+	string key = NormalizePath(path);
+
+	map<string, SDL_Texture*>::iterator cached = cache.find(key);
+	if (cached != cache.end())
+	{
+		++entries[cached->second].references;
+		return cached->second;
+	}
+
 	SDL_Texture* texture = NULL;
 	SDL_Surface* surface = IMG_Load_RW(App->fs->Load(path), 1);
 
@@ -73,7 +84,7 @@ SDL_Texture* const j1Textures::Load(const char* path)
 	}
 	else
 	{
-		texture = LoadSurface(surface);
+		texture = CreateTexture(surface, key);
 		SDL_FreeSurface(surface);
 	}
 
@@ -83,25 +94,64 @@ SDL_Texture* const j1Textures::Load(const char* path)
 // Unload texture
 bool j1Textures::UnLoad(SDL_Texture* texture)
 {
+	map<SDL_Texture*, TextureEntry>::iterator entry = entries.find(texture);
 
-	list<SDL_Texture*>::iterator i = textures.begin();
+	if (entry == entries.end())
+		return false;
 
-	while (i != textures.end())
-	{
-		if (texture == (*i))
-		{
-			SDL_DestroyTexture(*i);
-			textures.remove(*i);
-			return true;
-		}
-		++i;
-	}
+	//Still used by someone else
+	if (--entry->second.references > 0)
+		return true;
 
-	return false;
+	if (entry->second.path.empty() == false)
+		cache.erase(entry->second.path);
+
+	entries.erase(entry);
+	textures.remove(texture);
+	SDL_DestroyTexture(texture);
+
+	return true;
 }
 
 // Translate a surface into a texture
 SDL_Texture* const j1Textures::LoadSurface(SDL_Surface* surface)
+{
+	return CreateTexture(surface, string());
+}
+
+SDL_Texture* const j1Textures::LoadSurface(SDL_Surface* surface, const char* path)
+{
+	string key = NormalizePath(path);
+
+	//Someone loaded it meanwhile
+	map<string, SDL_Texture*>::iterator cached = cache.find(key);
+	if (cached != cache.end())
+	{
+		++entries[cached->second].references;
+		return cached->second;
+	}
+
+	return CreateTexture(surface, key);
+}
+
+bool j1Textures::IsLoaded(const char* path) const
+{
+	return cache.find(NormalizePath(path)) != cache.end();
+}
+
+string j1Textures::NormalizePath(const char* path)
+{
+	//The same file can be named with either slash
+	string key(path);
+	for (uint i = 0; i < key.size(); ++i)
+	{
+		if (key[i] == '\\')
+			key[i] = '/';
+	}
+	return key;
+}
+
+SDL_Texture* const j1Textures::CreateTexture(SDL_Surface* surface, const string& path)
 {
 	SDL_Texture* texture = SDL_CreateTextureFromSurface(App->render->renderer, surface);
 
@@ -112,11 +162,25 @@ SDL_Texture* const j1Textures::LoadSurface(SDL_Surface* surface)
 	else
 	{
 		textures.push_back(texture);
+
+		TextureEntry entry;
+		entry.path = path;
+		entry.references = 1;
+		entries[texture] = entry;
+
+		if (path.empty() == false)
+			cache[path] = texture;
 	}
 
 	return texture;
 }
 
+uint j1Textures::GetReferences(const SDL_Texture* texture) const
+{
+	map<SDL_Texture*, TextureEntry>::const_iterator entry = entries.find((SDL_Texture*)texture);
+	return (entry != entries.end()) ? entry->second.references : 0;
+}
+
 // Retrieve size of a texture
 void j1Textures::GetSize(const SDL_Texture* texture, uint& width, uint& height) const
 {
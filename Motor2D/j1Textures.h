@@ -3,12 +3,17 @@
 
 #include "j1Module.h"
 #include <list>
+#include <map>
 
 struct SDL_Texture;
 struct SDL_Surface;
 struct SDL_Rect;
 
-
+struct TextureEntry
+{
+	string	path; //Empty if it was created from a surface
+	uint	references;
+};
 
 class j1Textures : public j1Module
 {
@@ -28,15 +33,31 @@ public:
 	// Called before quitting
 	bool CleanUp();
 
-	// Load Texture
+	// Load Texture. A path already loaded returns the same texture, each Load() needs its UnLoad()
 	SDL_Texture* const	Load(const char* path);
+	// Frees the texture on its last reference
 	bool				UnLoad(SDL_Texture* texture);
 	SDL_Texture* const	LoadSurface(SDL_Surface* surface);
+	// Texture of a surface decoded from path, cached like Load(). The surface is not freed
+	SDL_Texture* const	LoadSurface(SDL_Surface* surface, const char* path);
+	bool				IsLoaded(const char* path) const;
 	void				GetSize(const SDL_Texture* texture, uint& width, uint& height) const;
 
+	uint				GetReferences(const SDL_Texture* texture) const;
+
+private:
+
+	SDL_Texture* const	CreateTexture(SDL_Surface* surface, const string& path);
+	static string		NormalizePath(const char* path);
+
 public:
 
 	list<SDL_Texture*>	textures;
+
+private:
+
+	map<string, SDL_Texture*>			cache; //Textures by normalized path
+	map<SDL_Texture*, TextureEntry>		entries;
 };
 
 
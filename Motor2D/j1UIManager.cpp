@@ -72,25 +72,17 @@ bool j1UIManager::LoadUiInfo()
 {
 	bool ret = true;
 
-	pugi::xml_document	ui_file;
 	pugi::xml_node		ui_elements;
 
-	char* buf;
-	int size = App->fs->Load(ui_file_path.c_str(), &buf);
-	pugi::xml_parse_result result = ui_file.load_buffer(buf, size);
-	
-	delete[] buf;
-	buf = NULL;
+	//Parsed once, the game UI is built again on each game
+	const pugi::xml_document* ui_file = App->fs->GetXML(ui_file_path.c_str());
 
-	if (result == NULL)
-	{
-		LOG("Could not load xml file %s. PUGI error: %s", ui_file_path.c_str(), result.description());
+	if (ui_file == NULL)
 		return false;
-	}
 	else
 	{
 		LOG("GUI ELEMENTS");
-		ui_elements = ui_file.child("gui_elements");
+		ui_elements = ui_file->child("gui_elements");
 	}
 
 	pugi::xml_node element;